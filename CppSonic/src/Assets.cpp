@@ -2,7 +2,6 @@
 
 #include "Game.h"
 #include <SDL_image.h>
-#include <SDL_ttf.h>
 
 #define X(_1, frame_count, _2, _3) frame_count,
 static int anim_frame_count[ANIM_COUNT] = {
@@ -29,6 +28,7 @@ static int anim_height[ANIM_COUNT] = {
 #undef X
 
 static SDL_Texture* anim_textures[ANIM_COUNT];
+static SDL_Surface* anim_surfaces[ANIM_COUNT];
 
 Font fnt_cp437;
 
@@ -41,6 +41,10 @@ static bool load_anim(anim_index anim, const char* fname) {
 
 	anim_textures[anim] = texture;
 
+	if (GetSoftFramebuffer(game->renderer)) {
+		anim_surfaces[anim] = LoadSoftSurface(fname);
+	}
+
 	return true;
 }
 
@@ -51,12 +55,11 @@ bool load_all_assets() {
 	LIST_OF_ALL_ANIMS
 	#undef X
 
-	TTF_Init();
-	{
-		LoadFontFromFileTTF(&fnt_cp437, "PerfectDOSVGA437Win.ttf", 16, game->renderer);
-		if (!fnt_cp437.texture) error = true;
+	// baked with the editor, run from the editor folder:
+	// editor --bake-font ../CppSonic/PerfectDOSVGA437Win.ttf 16 ../CppSonic/PerfectDOSVGA437Win_16.bin ../CppSonic/PerfectDOSVGA437Win_16.png
+	if (!LoadBakedFont(&fnt_cp437, "PerfectDOSVGA437Win_16.bin", "PerfectDOSVGA437Win_16.png", game->renderer)) {
+		error = true;
 	}
-	TTF_Quit();
 
 	return !error;
 }
@@ -64,6 +67,10 @@ bool load_all_assets() {
 void free_all_assets() {
 	for (int i = 0; i < ANIM_COUNT; i++) {
 		SDL_DestroyTexture(anim_textures[i]);
+		anim_textures[i] = nullptr;
+
+		if (anim_surfaces[i]) SDL_FreeSurface(anim_surfaces[i]);
+		anim_surfaces[i] = nullptr;
 	}
 
 	DestroyFont(&fnt_cp437);
@@ -83,6 +90,13 @@ SDL_Texture* anim_get_texture(anim_index anim) {
 	return nullptr;
 }
 
+SDL_Surface* anim_get_surface(anim_index anim) {
+	if (0 <= anim && anim < ANIM_COUNT) {
+		return anim_surfaces[anim];
+	}
+	return nullptr;
+}
+
 const char* anim_get_name(anim_index anim) {
 	if (0 <= anim && anim < ANIM_COUNT) {
 		return anim_names[anim];
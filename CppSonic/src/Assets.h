@@ -42,6 +42,7 @@ void free_all_assets();
 
 int anim_get_frame_count(anim_index anim);
 SDL_Texture* anim_get_texture(anim_index anim);
+SDL_Surface* anim_get_surface(anim_index anim); // only with the software renderer
 const char* anim_get_name(anim_index anim);
 int anim_get_width(anim_index anim);
 int anim_get_height(anim_index anim);
@@ -0,0 +1,208 @@
+#include "Background.h"
+
+#include "Game.h"
+
+#include <SDL_image.h>
+#include "misc.h"
+#include "mathh.h"
+
+static void add_strip(Background* bg, BackgroundStrip strip) {
+	if (bg->strip_count < BACKGROUND_MAX_STRIPS) {
+		bg->strips[bg->strip_count++] = strip;
+	}
+}
+
+static void load_strips(Background* bg, const char* fname) {
+	char* text = (char*) SDL_LoadFile(fname, nullptr);
+	if (!text) {
+		return;
+	}
+
+	for (char* line = text; *line;) {
+		char* next = line;
+		while (*next && *next != '\n') next++;
+		if (*next) *next++ = 0;
+
+		float factor_y;
+		int y;
+		int h;
+		float factor;
+		float factor_last;
+		float speed = 0.0f;
+
+		if (line[0] == '#') {
+			// comment
+		} else if (SDL_sscanf(line, "y_factor %f", &factor_y) == 1) {
+			bg->factor_y = factor_y;
+		} else {
+			int count = SDL_sscanf(line, "%d %d %f %f %f", &y, &h, &factor, &factor_last, &speed);
+			if (count >= 3 && h > 0) {
+				if (count == 3) {
+					factor_last = factor;
+				}
+
+				if (factor_last == factor) {
+					add_strip(bg, {y, h, factor, speed, 0.0f});
+				} else {
+					// one strip per row
+					for (int row = 0; row < h; row++) {
+						float f = lerp(factor, factor_last, (h > 1) ? float(row) / float(h - 1) : 0.0f);
+						add_strip(bg, {y + row, 1, f, speed, 0.0f});
+					}
+				}
+			}
+		}
+
+		line = next;
+	}
+
+	SDL_free(text);
+}
+
+bool Background::Load(const char* image_fname, const char* strips_fname, int view_w) {
+	Destroy();
+
+	bool result = false;
+
+	SDL_Surface* image = nullptr;
+	SDL_Surface* cache = nullptr;
+
+	{
+		SDL_Surface* loaded = IMG_Load(image_fname);
+		if (!loaded) {
+			goto out;
+		}
+
+		image = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+		SDL_FreeSurface(loaded);
+
+		if (!image) {
+			goto out;
+		}
+
+		load_strips(this, strips_fname);
+
+		// strips have to be inside the image
+		int count = 0;
+		for (int i = 0; i < strip_count; i++) {
+			if (strips[i].y >= 0 && strips[i].y + strips[i].h <= image->h) {
+				strips[count++] = strips[i];
+			}
+		}
+		strip_count = count;
+
+		// without a strips file the image scrolls as one
+		if (strip_count == 0) {
+			add_strip(this, {0, image->h, 0.5f, 0.0f, 0.0f});
+		}
+
+		image_w = image->w;
+		cache_w = image->w * ((max(view_w, 1) + image->w - 1) / image->w);
+		h = image->h;
+
+		cache = SDL_CreateRGBSurfaceWithFormat(0, cache_w, h, 32, SDL_PIXELFORMAT_ARGB8888);
+		if (!cache) {
+			goto out;
+		}
+
+		SDL_SetSurfaceBlendMode(image, SDL_BLENDMODE_NONE);
+		for (int x = 0; x < cache_w; x += image_w) {
+			SDL_Rect dest = {x, 0, image_w, h};
+			SDL_BlitSurface(image, nullptr, cache, &dest);
+		}
+
+		texture = SDL_CreateTextureFromSurface(game->renderer, cache);
+		if (!texture) {
+			goto out;
+		}
+
+		if (GetSoftFramebuffer(game->renderer)) {
+			surface = cache;
+			cache = nullptr;
+		}
+
+		batch.Init();
+
+		result = true;
+	}
+
+out:
+	if (cache) SDL_FreeSurface(cache);
+	if (image) SDL_FreeSurface(image);
+
+	if (!result) {
+		Destroy();
+	}
+
+	return result;
+}
+
+void Background::Destroy() {
+	if (texture) {
+		batch.Destroy();
+		SDL_DestroyTexture(texture);
+	}
+
+	if (surface) SDL_FreeSurface(surface);
+
+	*this = {};
+}
+
+void Background::Update(float delta) {
+	for (int i = 0; i < strip_count; i++) {
+		BackgroundStrip* strip = &strips[i];
+		if (strip->speed != 0.0f) {
+			strip->offset = fmodf(strip->offset + strip->speed * delta, float(image_w));
+		}
+	}
+}
+
+void Background::Draw(float camera_x, float camera_y, int view_w, int view_h) {
+	if (!texture) {
+		return;
+	}
+
+	SoftFramebuffer* fb = GetSoftFramebuffer(game->renderer);
+
+	if (!fb) {
+		batch.Begin(texture);
+	}
+
+	int scroll_y = int(camera_y * factor_y);
+
+	for (int i = 0; i < strip_count; i++) {
+		BackgroundStrip* strip = &strips[i];
+
+		int dest_y = strip->y - scroll_y;
+		if (dest_y + strip->h <= 0 || dest_y >= view_h) {
+			continue;
+		}
+
+		// where the left edge of the view is in the image
+		int scroll_x = int(camera_x * strip->factor + strip->offset) % image_w;
+		if (scroll_x < 0) scroll_x += image_w;
+
+		// usually two copies cover the view, but the view can be wider than
+		// the cache was made for (the editor zoomed out)
+		int src_x = scroll_x;
+		for (int x = 0; x < view_w;) {
+			int w = min(cache_w - src_x, view_w - x);
+
+			SDL_Rect src = {src_x, strip->y, w, strip->h};
+			SDL_Rect dest = {x, dest_y, w, strip->h};
+
+			if (fb) {
+				if (surface) SoftBlitSprite(fb, surface, src, dest, 0.0, SDL_FLIP_NONE);
+			} else {
+				batch.Add(src, dest, SDL_FLIP_NONE);
+			}
+
+			x += w;
+			src_x = 0;
+		}
+	}
+
+	if (!fb) {
+		batch.Flush();
+	}
+}
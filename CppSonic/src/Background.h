@@ -0,0 +1,45 @@
+#pragma once
+
+#include <SDL.h>
+
+#include "TileBatch.h"
+
+// Parallax background made of horizontal strips of one image, each scrolling
+// at its own rate. A strip can be split into single rows with rates going from
+// one value to another, like the water in GHZ.
+#define BACKGROUND_MAX_STRIPS 512
+
+struct BackgroundStrip {
+	int y;        // rows of the image
+	int h;
+	float factor; // how far it scrolls per pixel the camera does
+	float speed;  // pixels per frame it scrolls on its own
+	float offset;
+};
+
+struct Background {
+	BackgroundStrip strips[BACKGROUND_MAX_STRIPS];
+	int strip_count;
+	float factor_y;
+
+	// The image repeated sideways to at least the view's width from Load, so a
+	// strip is usually drawn with two copies, more if the view got wider since.
+	// All copies go in one batch.
+	SDL_Texture* texture;
+	SDL_Surface* surface; // ARGB8888, only kept for the software renderer
+	int image_w;
+	int cache_w;
+	int h;
+
+	TileBatch batch;
+
+	// The strips file has one strip per line: the first row, the height, the
+	// factor, then optionally the factor of the last row and a speed. A line
+	// "y_factor f" sets the vertical factor. Returns false if there's no
+	// background.
+	bool Load(const char* image_fname, const char* strips_fname, int view_w);
+	void Destroy();
+
+	void Update(float delta);
+	void Draw(float camera_x, float camera_y, int view_w, int view_h);
+};
@@ -0,0 +1,213 @@
+#include "ChunkCache.h"
+
+#include "Game.h"
+
+#include "misc.h"
+#include "mathh.h"
+
+void ChunkCache::Init(int budget_bytes) {
+	max_entries = max(budget_bytes / CHUNK_TEXTURE_BYTES, 0);
+
+	if (!SDL_RenderTargetSupported(game->renderer)) {
+		max_entries = 0;
+	}
+
+	entries = (ChunkCacheEntry*) ecalloc(max(max_entries, 1), sizeof(*entries));
+
+	batch.Init();
+}
+
+void ChunkCache::Destroy() {
+	for (int i = 0; i < entry_count; i++) {
+		SDL_DestroyTexture(entries[i].texture);
+	}
+
+	if (entries) free(entries);
+	entries = nullptr;
+
+	batch.Destroy();
+
+	entry_count = 0;
+	max_entries = 0;
+}
+
+void ChunkCache::Clear() {
+	for (int i = 0; i < entry_count; i++) {
+		entries[i].valid = false;
+	}
+}
+
+void ChunkCache::InvalidateTile(int tile_x, int tile_y, int layer) {
+	int chunk_x = tile_x / CHUNK_TILES;
+	int chunk_y = tile_y / CHUNK_TILES;
+
+	for (int i = 0; i < entry_count; i++) {
+		ChunkCacheEntry* entry = &entries[i];
+		if (entry->chunk_x == chunk_x && entry->chunk_y == chunk_y && entry->layer == layer) {
+			entry->valid = false;
+		}
+	}
+}
+
+SDL_Texture* ChunkCache::FindChunk(int chunk_x, int chunk_y, int layer, bool priority) {
+	for (int i = 0; i < entry_count; i++) {
+		ChunkCacheEntry* entry = &entries[i];
+		if (entry->valid && entry->chunk_x == chunk_x && entry->chunk_y == chunk_y && entry->layer == layer
+			&& entry->priority == priority) {
+			return entry->texture;
+		}
+	}
+	return nullptr;
+}
+
+static void render_chunk(ChunkCacheEntry* entry, TileMap* tilemap, TileSet* tileset, TileBatch* batch) {
+	SDL_SetRenderDrawColor(game->renderer, 0, 0, 0, 0);
+	SDL_RenderClear(game->renderer);
+
+	batch->Begin(tileset->texture);
+
+	int start_x = entry->chunk_x * CHUNK_TILES;
+	int start_y = entry->chunk_y * CHUNK_TILES;
+
+	int end_x = min(start_x + CHUNK_TILES, tilemap->width);
+	int end_y = min(start_y + CHUNK_TILES, tilemap->height);
+
+	for (int y = start_y; y < end_y; y++) {
+		for (int x = start_x; x < end_x; x++) {
+			Tile tile = tilemap->GetTileGraphicUnchecked(x, y, entry->layer);
+			if (tile.priority != entry->priority) {
+				continue;
+			}
+
+			SDL_Rect src = tileset->GetTextureSrcRect(tile.index);
+
+			SDL_Rect dest = {
+				(x - start_x) * 16,
+				(y - start_y) * 16,
+				16,
+				16
+			};
+
+			int flip = SDL_FLIP_NONE;
+			if (tile.hflip) flip |= SDL_FLIP_HORIZONTAL;
+			if (tile.vflip) flip |= SDL_FLIP_VERTICAL;
+			batch->Add(src, dest, flip);
+		}
+	}
+
+	batch->Flush();
+
+	entry->valid = true;
+}
+
+void ChunkCache::Update(TileMap* tilemap, TileSet* tileset, float view_x, float view_y, int view_w, int view_h) {
+	frame++;
+	rendered_last_frame = 0;
+
+	if (max_entries == 0 || !tileset->texture) {
+		return;
+	}
+
+	// a chunk must not straddle a region that isn't resident
+	if (tilemap->regions && tilemap->region_size % CHUNK_TILES != 0) {
+		return;
+	}
+
+	int start_x = max(int(view_x) / CHUNK_SIZE, 0);
+	int start_y = max(int(view_y) / CHUNK_SIZE, 0);
+
+	int end_x = min((int(view_x) + view_w) / CHUNK_SIZE, (tilemap->width  - 1) / CHUNK_TILES);
+	int end_y = min((int(view_y) + view_h) / CHUNK_SIZE, (tilemap->height - 1) / CHUNK_TILES);
+
+	SDL_Texture* old_target = nullptr;
+	float scale_x = 1.0f;
+	float scale_y = 1.0f;
+	Uint8 r, g, b, a;
+	SDL_BlendMode blend_mode = SDL_BLENDMODE_BLEND;
+	bool switched_target = false;
+
+	for (int layer = 0; layer < tilemap->layer_count; layer++) {
+		if (!(tilemap->layer_flags[layer] & (TILE_LAYER_BACKGROUND | TILE_LAYER_FOREGROUND))) {
+			continue;
+		}
+
+		for (int chunk_y = start_y; chunk_y <= end_y; chunk_y++) {
+			for (int chunk_x = start_x; chunk_x <= end_x; chunk_x++) {
+				for (int priority = 0; priority < 2; priority++) {
+					ChunkCacheEntry* entry = nullptr;
+					ChunkCacheEntry* lru = nullptr;
+
+					for (int i = 0; i < entry_count; i++) {
+						ChunkCacheEntry* e = &entries[i];
+						if (e->chunk_x == chunk_x && e->chunk_y == chunk_y && e->layer == layer && e->priority == priority) {
+							entry = e;
+							break;
+						}
+						if (e->last_used != frame && (!lru || e->last_used < lru->last_used)) {
+							lru = e;
+						}
+					}
+
+					if (!entry) {
+						if (entry_count < max_entries) {
+							SDL_Texture* texture = SDL_CreateTexture(game->renderer,
+																	 SDL_PIXELFORMAT_ARGB8888,
+																	 SDL_TEXTUREACCESS_TARGET,
+																	 CHUNK_SIZE, CHUNK_SIZE);
+							if (!texture) {
+								max_entries = entry_count;
+								continue;
+							}
+							SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+
+							entry = &entries[entry_count++];
+							entry->texture = texture;
+						} else if (lru) {
+							entry = lru;
+						} else {
+							// everything cached is on screen
+							continue;
+						}
+
+						entry->chunk_x = chunk_x;
+						entry->chunk_y = chunk_y;
+						entry->layer = layer;
+						entry->priority = priority;
+						entry->valid = false;
+					}
+
+					entry->last_used = frame;
+
+					if (entry->valid) {
+						continue;
+					}
+
+					if (!switched_target) {
+						// switching targets resets the scale, and the editor draws zoomed
+						old_target = SDL_GetRenderTarget(game->renderer);
+						SDL_RenderGetScale(game->renderer, &scale_x, &scale_y);
+						SDL_GetRenderDrawColor(game->renderer, &r, &g, &b, &a);
+
+						// tiles don't overlap, so they can be copied as they are,
+						// alpha included, and blended once when the chunk is drawn
+						SDL_GetTextureBlendMode(tileset->texture, &blend_mode);
+						SDL_SetTextureBlendMode(tileset->texture, SDL_BLENDMODE_NONE);
+
+						switched_target = true;
+					}
+
+					SDL_SetRenderTarget(game->renderer, entry->texture);
+					render_chunk(entry, tilemap, tileset, &batch);
+					rendered_last_frame++;
+				}
+			}
+		}
+	}
+
+	if (switched_target) {
+		SDL_SetTextureBlendMode(tileset->texture, blend_mode);
+		SDL_SetRenderTarget(game->renderer, old_target);
+		SDL_RenderSetScale(game->renderer, scale_x, scale_y);
+		SDL_SetRenderDrawColor(game->renderer, r, g, b, a);
+	}
+}
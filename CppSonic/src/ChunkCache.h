@@ -0,0 +1,51 @@
+#pragma once
+
+#include "TileSet.h"
+#include "TileMap.h"
+#include "TileBatch.h"
+
+// A chunk is 16x16 tiles of one layer and priority, pre-rendered into its own
+// texture so the tilemap can be drawn with a few copies instead of one per tile.
+#define CHUNK_TILES 16
+#define CHUNK_SIZE (CHUNK_TILES * 16)
+#define CHUNK_TEXTURE_BYTES (CHUNK_SIZE * CHUNK_SIZE * 4)
+
+#define CHUNK_CACHE_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+struct ChunkCacheEntry {
+	SDL_Texture* texture;
+	int chunk_x;
+	int chunk_y;
+	int layer;
+	bool priority;      // only tiles with this priority are in it
+	bool valid;         // the texture matches the tiles
+	uint32_t last_used; // frame number
+};
+
+struct ChunkCache {
+	ChunkCacheEntry* entries;
+	int entry_count;
+	int max_entries; // how many textures fit in the budget
+	uint32_t frame;
+	TileBatch batch;
+
+	int rendered_last_frame;
+
+	void Init(int budget_bytes = CHUNK_CACHE_DEFAULT_BUDGET);
+	void Destroy();
+
+	// Marks every chunk as stale, keeping the textures for reuse. Call when
+	// the tileset or the whole tilemap changes, or the render targets were lost.
+	void Clear();
+
+	// Call after changing a tile.
+	void InvalidateTile(int tile_x, int tile_y, int layer);
+
+	// Call once per frame before drawing. Renders the chunks of every drawn
+	// layer that overlap the view, least recently used textures are reused
+	// once the budget is full.
+	void Update(TileMap* tilemap, TileSet* tileset, float view_x, float view_y, int view_w, int view_h);
+
+	// nullptr if the chunk isn't cached, draw its tiles one by one then.
+	SDL_Texture* FindChunk(int chunk_x, int chunk_y, int layer, bool priority);
+};
@@ -0,0 +1,624 @@
+#include "Compression.h"
+
+#include <string.h> // for strrchr, memcpy
+
+struct InputStream {
+	SDL_RWops* f;
+	size_t limit; // bytes that may still be read from f
+	uint8_t buf[4096];
+	size_t pos;
+	size_t len;
+	bool eof;
+
+	void Refill() {
+		size_t want = (limit < sizeof(buf)) ? limit : sizeof(buf);
+		pos = 0;
+		len = (want > 0) ? SDL_RWread(f, buf, 1, want) : 0;
+		limit -= len;
+		if (len == 0) {
+			eof = true;
+		}
+	}
+
+	size_t Remaining() {
+		return (eof) ? 0 : (len - pos) + limit;
+	}
+
+	uint8_t ReadByte() {
+		if (pos == len) {
+			Refill();
+			if (eof) {
+				return 0;
+			}
+		}
+		return buf[pos++];
+	}
+
+	void ReadBytes(uint8_t* dest, size_t count) {
+		while (count > 0) {
+			if (pos == len) {
+				Refill();
+				if (eof) {
+					return;
+				}
+			}
+			size_t n = (count < len - pos) ? count : len - pos;
+			memcpy(dest, buf + pos, n);
+			pos += n;
+			dest += n;
+			count -= n;
+		}
+	}
+
+	uint16_t ReadLE16() {
+		uint16_t lo = ReadByte();
+		uint16_t hi = ReadByte();
+		return (hi << 8) | lo;
+	}
+
+	uint16_t ReadBE16() {
+		uint16_t hi = ReadByte();
+		uint16_t lo = ReadByte();
+		return (hi << 8) | lo;
+	}
+};
+
+struct OutputBuffer {
+	uint8_t* data;
+	size_t size;
+	size_t capacity;
+
+	bool Reserve(size_t count) {
+		if (size + count <= capacity) {
+			return true;
+		}
+
+		size_t new_capacity = (capacity > 0) ? capacity : 4096;
+		while (new_capacity < size + count) {
+			new_capacity *= 2;
+		}
+
+		uint8_t* new_data = (uint8_t*) SDL_realloc(data, new_capacity);
+		if (!new_data) {
+			return false;
+		}
+
+		data = new_data;
+		capacity = new_capacity;
+		return true;
+	}
+};
+
+uint8_t* KosinskiDecompress(SDL_RWops* src, size_t* out_size) {
+	InputStream* in = (InputStream*) SDL_calloc(1, sizeof(*in));
+	OutputBuffer out = {};
+	bool ok = false;
+
+	if (!in) {
+		goto out;
+	}
+
+	in->f = src;
+	in->limit = SIZE_MAX;
+
+	{
+		// 16-bit little-endian descriptor, consumed LSB first.
+		// A new one is fetched as soon as the last bit is used.
+		uint16_t descriptor = in->ReadLE16();
+		int descriptor_bits = 16;
+
+		auto pop_bit = [&]() {
+			bool bit = descriptor & 1;
+			descriptor >>= 1;
+			if (--descriptor_bits == 0) {
+				descriptor = in->ReadLE16();
+				descriptor_bits = 16;
+			}
+			return bit;
+		};
+
+		while (!in->eof) {
+			if (pop_bit()) {
+				// literal
+				if (!out.Reserve(1)) goto out;
+				out.data[out.size++] = in->ReadByte();
+				continue;
+			}
+
+			size_t distance;
+			size_t count;
+
+			if (pop_bit()) {
+				// full match
+				uint8_t lo = in->ReadByte();
+				uint8_t hi = in->ReadByte();
+
+				distance = 0x2000 - (((hi & 0xF8) << 5) | lo);
+				count = hi & 7;
+
+				if (count != 0) {
+					count += 2;
+				} else {
+					count = in->ReadByte() + 1;
+					if (count == 1) {
+						ok = true;
+						break;
+					}
+					if (count == 2) {
+						continue;
+					}
+				}
+			} else {
+				// inline match
+				count = 2;
+				if (pop_bit()) count += 2;
+				if (pop_bit()) count += 1;
+				distance = 0x100 - in->ReadByte();
+			}
+
+			if (distance > out.size) {
+				goto out;
+			}
+
+			if (!out.Reserve(count)) goto out;
+
+			// byte by byte, matches may overlap the bytes they produce
+			uint8_t* from = out.data + out.size - distance;
+			for (size_t i = 0; i < count; i++) {
+				out.data[out.size + i] = from[i];
+			}
+			out.size += count;
+		}
+	}
+
+out:
+	if (in) SDL_free(in);
+
+	if (!ok) {
+		if (out.data) SDL_free(out.data);
+		*out_size = 0;
+		return nullptr;
+	}
+
+	*out_size = out.size;
+	return out.data;
+}
+
+uint16_t* EnigmaDecompress(SDL_RWops* src, size_t* out_count, uint16_t starting_art_tile) {
+	InputStream* in = (InputStream*) SDL_calloc(1, sizeof(*in));
+	OutputBuffer out = {};
+	bool ok = false;
+
+	if (!in) {
+		goto out;
+	}
+
+	in->f = src;
+	in->limit = SIZE_MAX;
+
+	{
+		int packet_bits = in->ReadByte();
+		int flag_mask = in->ReadByte();
+		uint16_t increment_word = in->ReadBE16() + starting_art_tile;
+		uint16_t literal_word   = in->ReadBE16() + starting_art_tile;
+
+		if (in->eof || packet_bits > 16) {
+			goto out;
+		}
+
+		// bitstream is consumed MSB first
+		uint32_t bits = 0;
+		int bits_left = 0;
+
+		auto read_bits = [&](int count) {
+			uint32_t result = 0;
+			while (count--) {
+				if (bits_left == 0) {
+					bits = in->ReadByte();
+					bits_left = 8;
+				}
+				bits_left--;
+				result = (result << 1) | ((bits >> bits_left) & 1);
+			}
+			return result;
+		};
+
+		auto read_inline_value = [&]() {
+			uint16_t value = 0;
+			if ((flag_mask & 0x10) && read_bits(1)) value |= 0x8000; // priority
+			if ((flag_mask & 0x08) && read_bits(1)) value |= 0x4000; // palette high
+			if ((flag_mask & 0x04) && read_bits(1)) value |= 0x2000; // palette low
+			if ((flag_mask & 0x02) && read_bits(1)) value |= 0x1000; // vflip
+			if ((flag_mask & 0x01) && read_bits(1)) value |= 0x0800; // hflip
+			value |= read_bits(packet_bits);
+			return uint16_t(value + starting_art_tile);
+		};
+
+		auto put = [&](uint16_t word) {
+			if (!out.Reserve(sizeof(word))) return false;
+			memcpy(out.data + out.size, &word, sizeof(word));
+			out.size += sizeof(word);
+			return true;
+		};
+
+		while (!in->eof) {
+			int mode;
+			if (read_bits(1) == 0) {
+				mode = read_bits(1);
+			} else {
+				mode = 0b100 | read_bits(2);
+			}
+
+			int count = read_bits(4) + 1;
+
+			switch (mode) {
+				case 0b00: {
+					for (int i = 0; i < count; i++) if (!put(increment_word++)) goto out;
+					break;
+				}
+				case 0b01: {
+					for (int i = 0; i < count; i++) if (!put(literal_word)) goto out;
+					break;
+				}
+				case 0b100: {
+					uint16_t value = read_inline_value();
+					for (int i = 0; i < count; i++) if (!put(value)) goto out;
+					break;
+				}
+				case 0b101: {
+					uint16_t value = read_inline_value();
+					for (int i = 0; i < count; i++) if (!put(value++)) goto out;
+					break;
+				}
+				case 0b110: {
+					uint16_t value = read_inline_value();
+					for (int i = 0; i < count; i++) if (!put(value--)) goto out;
+					break;
+				}
+				case 0b111: {
+					if (count == 16) {
+						ok = true;
+						goto out;
+					}
+					for (int i = 0; i < count; i++) if (!put(read_inline_value())) goto out;
+					break;
+				}
+			}
+		}
+	}
+
+out:
+	if (in) SDL_free(in);
+
+	if (!ok) {
+		if (out.data) SDL_free(out.data);
+		*out_count = 0;
+		return nullptr;
+	}
+
+	*out_count = out.size / sizeof(uint16_t);
+	return (uint16_t*) out.data;
+}
+
+static bool has_extension(const char* fname, const char* ext) {
+	const char* dot = strrchr(fname, '.');
+	return dot && SDL_strcasecmp(dot, ext) == 0;
+}
+
+void* LoadFileDecompressed(const char* fname, size_t* out_size) {
+	if (!has_extension(fname, ".kos") && !has_extension(fname, ".eni")) {
+		return SDL_LoadFile(fname, out_size);
+	}
+
+	*out_size = 0;
+
+	SDL_RWops* f = SDL_RWFromFile(fname, "rb");
+	if (!f) {
+		return nullptr;
+	}
+
+	void* result = nullptr;
+
+	if (has_extension(fname, ".kos")) {
+		result = KosinskiDecompress(f, out_size);
+	} else {
+		size_t count;
+		uint16_t* words = EnigmaDecompress(f, &count);
+		if (words) {
+			for (size_t i = 0; i < count; i++) {
+				words[i] = SDL_SwapBE16(words[i]);
+			}
+			*out_size = count * sizeof(*words);
+		}
+		result = words;
+	}
+
+	SDL_RWclose(f);
+
+	return result;
+}
+
+size_t LZ4CompressBound(size_t size) {
+	return size + size / 255 + 16;
+}
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_MFLIMIT 12      // the last match must start at least this far from the end
+#define LZ4_LAST_LITERALS 5 // and the block must end with at least this many literals
+#define LZ4_HASH_BITS 12
+
+static uint32_t read32(const uint8_t* p) {
+	uint32_t result;
+	memcpy(&result, p, sizeof(result));
+	return result;
+}
+
+size_t LZ4Compress(const void* src, size_t src_size, void* dest) {
+	const uint8_t* in = (const uint8_t*) src;
+	uint8_t* out = (uint8_t*) dest;
+
+	uint32_t table[1 << LZ4_HASH_BITS] = {};
+
+	auto write_length = [&](size_t length) {
+		while (length >= 255) {
+			*out++ = 255;
+			length -= 255;
+		}
+		*out++ = (uint8_t) length;
+	};
+
+	auto write_sequence = [&](size_t literal_start, size_t literal_count, size_t offset, size_t match_length) {
+		size_t literal_nibble = (literal_count < 15) ? literal_count : 15;
+		size_t match_nibble = 0;
+		if (match_length > 0) {
+			match_nibble = (match_length - LZ4_MIN_MATCH < 15) ? match_length - LZ4_MIN_MATCH : 15;
+		}
+
+		*out++ = uint8_t((literal_nibble << 4) | match_nibble);
+		if (literal_nibble == 15) write_length(literal_count - 15);
+
+		memcpy(out, in + literal_start, literal_count);
+		out += literal_count;
+
+		if (match_length > 0) {
+			*out++ = uint8_t(offset & 0xFF);
+			*out++ = uint8_t(offset >> 8);
+			if (match_nibble == 15) write_length(match_length - LZ4_MIN_MATCH - 15);
+		}
+	};
+
+	size_t anchor = 0;
+	size_t ip = 0;
+
+	while (ip + LZ4_MFLIMIT <= src_size) {
+		uint32_t sequence = read32(in + ip);
+		uint32_t hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+		size_t candidate = table[hash];
+		table[hash] = (uint32_t) ip;
+
+		if (candidate < ip && ip - candidate <= 0xFFFF && read32(in + candidate) == sequence) {
+			size_t match_length = LZ4_MIN_MATCH;
+			while (ip + match_length < src_size - LZ4_LAST_LITERALS
+				   && in[candidate + match_length] == in[ip + match_length]) {
+				match_length++;
+			}
+
+			write_sequence(anchor, ip - anchor, ip - candidate, match_length);
+
+			ip += match_length;
+			anchor = ip;
+		} else {
+			ip++;
+		}
+	}
+
+	write_sequence(anchor, src_size - anchor, 0, 0);
+
+	return out - (uint8_t*) dest;
+}
+
+bool LZ4WriteSection(SDL_RWops* dest, const void* data, size_t size) {
+	uint8_t* compressed = (uint8_t*) SDL_malloc(LZ4CompressBound(size));
+	if (!compressed) {
+		return false;
+	}
+
+	uint32_t compressed_size = (uint32_t) LZ4Compress(data, size, compressed);
+
+	bool ok = (SDL_RWwrite(dest, &compressed_size, sizeof(compressed_size), 1) == 1
+			   && SDL_RWwrite(dest, compressed, 1, compressed_size) == compressed_size);
+
+	SDL_free(compressed);
+
+	return ok;
+}
+
+bool LZ4ReadSection(SDL_RWops* src, void* dest, size_t dest_size) {
+	uint32_t compressed_size;
+	if (SDL_RWread(src, &compressed_size, sizeof(compressed_size), 1) != 1) {
+		return false;
+	}
+
+	InputStream in = {};
+	in.f = src;
+	in.limit = compressed_size;
+
+	uint8_t* out = (uint8_t*) dest;
+	size_t out_pos = 0;
+
+	auto read_length = [&](size_t length) {
+		uint8_t b;
+		do {
+			b = in.ReadByte();
+			length += b;
+		} while (b == 255 && !in.eof);
+		return length;
+	};
+
+	while (in.Remaining() > 0) {
+		uint8_t token = in.ReadByte();
+
+		size_t literal_count = token >> 4;
+		if (literal_count == 15) literal_count = read_length(literal_count);
+
+		if (literal_count > dest_size - out_pos) {
+			return false;
+		}
+
+		in.ReadBytes(out + out_pos, literal_count);
+		out_pos += literal_count;
+
+		// the last sequence has no match part
+		if (in.Remaining() == 0) {
+			break;
+		}
+
+		size_t offset = in.ReadLE16();
+		if (offset == 0 || offset > out_pos) {
+			return false;
+		}
+
+		size_t match_length = token & 15;
+		if (match_length == 15) match_length = read_length(match_length);
+		match_length += LZ4_MIN_MATCH;
+
+		if (match_length > dest_size - out_pos) {
+			return false;
+		}
+
+		// byte by byte, matches may overlap the bytes they produce
+		uint8_t* from = out + out_pos - offset;
+		for (size_t i = 0; i < match_length; i++) {
+			out[out_pos + i] = from[i];
+		}
+		out_pos += match_length;
+	}
+
+	return !in.eof && out_pos == dest_size;
+}
+
+#define LZ4_WINDOW_SIZE 65536 // offsets are 16 bits
+
+struct LZ4SectionReader {
+	InputStream in;
+	uint8_t window[LZ4_WINDOW_SIZE]; // the output so far, wrapped around
+	size_t out_pos;
+
+	// where the current sequence is at
+	uint8_t token;
+	bool match_next; // the literals are out, the match part comes next
+	size_t literals_left;
+	size_t match_left;
+	size_t match_offset;
+
+	bool error;
+};
+
+LZ4SectionReader* LZ4OpenSection(SDL_RWops* src) {
+	uint32_t compressed_size;
+	if (SDL_RWread(src, &compressed_size, sizeof(compressed_size), 1) != 1) {
+		return nullptr;
+	}
+
+	LZ4SectionReader* reader = (LZ4SectionReader*) SDL_calloc(1, sizeof(*reader));
+	if (!reader) {
+		return nullptr;
+	}
+
+	reader->in.f = src;
+	reader->in.limit = compressed_size;
+	return reader;
+}
+
+static void window_append(LZ4SectionReader* reader, const uint8_t* data, size_t count) {
+	while (count > 0) {
+		size_t at = reader->out_pos % LZ4_WINDOW_SIZE;
+		size_t n = (count < LZ4_WINDOW_SIZE - at) ? count : LZ4_WINDOW_SIZE - at;
+		memcpy(reader->window + at, data, n);
+		reader->out_pos += n;
+		data += n;
+		count -= n;
+	}
+}
+
+bool LZ4ReadSectionPart(LZ4SectionReader* reader, void* dest, size_t size) {
+	InputStream* in = &reader->in;
+	uint8_t* out = (uint8_t*) dest;
+
+	auto read_length = [in](size_t length) {
+		uint8_t b;
+		do {
+			b = in->ReadByte();
+			length += b;
+		} while (b == 255 && !in->eof);
+		return length;
+	};
+
+	while (size > 0 && !reader->error) {
+		if (reader->literals_left > 0) {
+			size_t n = (reader->literals_left < size) ? reader->literals_left : size;
+			in->ReadBytes(out, n);
+			if (in->eof) {
+				reader->error = true;
+				break;
+			}
+
+			window_append(reader, out, n);
+			reader->literals_left -= n;
+			out += n;
+			size -= n;
+		} else if (reader->match_left > 0) {
+			// byte by byte, matches may overlap the bytes they produce
+			size_t n = (reader->match_left < size) ? reader->match_left : size;
+			for (size_t i = 0; i < n; i++) {
+				uint8_t b = reader->window[(reader->out_pos - reader->match_offset) % LZ4_WINDOW_SIZE];
+				reader->window[reader->out_pos % LZ4_WINDOW_SIZE] = b;
+				reader->out_pos++;
+				*out++ = b;
+			}
+			reader->match_left -= n;
+			size -= n;
+		} else if (in->Remaining() == 0) {
+			// the last sequence has no match part, there's no more output
+			reader->error = true;
+		} else if (reader->match_next) {
+			reader->match_next = false;
+
+			size_t offset = in->ReadLE16();
+			if (offset == 0 || offset > reader->out_pos) {
+				reader->error = true;
+				break;
+			}
+
+			size_t match_length = reader->token & 15;
+			if (match_length == 15) match_length = read_length(match_length);
+
+			reader->match_offset = offset;
+			reader->match_left = match_length + LZ4_MIN_MATCH;
+		} else {
+			reader->token = in->ReadByte();
+
+			size_t literal_count = reader->token >> 4;
+			if (literal_count == 15) literal_count = read_length(literal_count);
+
+			reader->literals_left = literal_count;
+			reader->match_next = true;
+		}
+	}
+
+	return !reader->error && !in->eof;
+}
+
+bool LZ4CloseSection(LZ4SectionReader* reader) {
+	if (!reader) {
+		return false;
+	}
+
+	bool result = (!reader->error && !reader->in.eof
+				   && reader->literals_left == 0 && reader->match_left == 0
+				   && reader->in.Remaining() == 0);
+
+	SDL_free(reader);
+
+	return result;
+}
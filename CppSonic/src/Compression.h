@@ -0,0 +1,43 @@
+#pragma once
+
+#include <SDL.h>
+#include <stdint.h>
+
+// Decompressors for the Sega formats used by the original S1 data.
+// Input is streamed from an SDL_RWops through a small buffer, so a compressed
+// file is never read whole. Returned buffers are allocated with SDL_malloc
+// (free them with SDL_free, same as SDL_LoadFile).
+
+// Kosinski (256x256 chunk mappings).
+uint8_t* KosinskiDecompress(SDL_RWops* src, size_t* out_size);
+
+// Enigma (16x16 block mappings, plane maps). Words are returned in native byte order.
+uint16_t* EnigmaDecompress(SDL_RWops* src, size_t* out_count, uint16_t starting_art_tile = 0);
+
+// Like SDL_LoadFile, but decompresses ".kos" and ".eni" files.
+// Enigma output is converted back to big-endian so the result matches the uncompressed file.
+void* LoadFileDecompressed(const char* fname, size_t* out_size);
+
+// Our own level files (tilemap.bin, tileset.bin, objects.bin) start with this
+// instead of their first field when they were exported compressed. It's negative,
+// so it can't be mistaken for a size or a count. The header fields follow as
+// usual, and every array is stored as an LZ4 section.
+#define LZ4_LEVEL_MAGIC int(0xC54C5A34)
+
+// An LZ4 section is a 32-bit compressed size followed by one LZ4 block.
+// Reading decompresses straight into dest, which must be exactly the uncompressed size.
+bool LZ4WriteSection(SDL_RWops* dest, const void* data, size_t size);
+bool LZ4ReadSection(SDL_RWops* src, void* dest, size_t dest_size);
+
+// Reads a section a piece at a time, for data that shouldn't be decompressed
+// into one big buffer. Only the last 64 KB of output are kept, as far back as
+// a match can reach. Close returns false if the section was corrupted or not
+// read exactly to its end.
+struct LZ4SectionReader;
+LZ4SectionReader* LZ4OpenSection(SDL_RWops* src);
+bool LZ4ReadSectionPart(LZ4SectionReader* reader, void* dest, size_t size);
+bool LZ4CloseSection(LZ4SectionReader* reader);
+
+// dest must hold at least LZ4CompressBound(src_size) bytes.
+size_t LZ4CompressBound(size_t size);
+size_t LZ4Compress(const void* src, size_t src_size, void* dest);
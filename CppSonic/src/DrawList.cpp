@@ -0,0 +1,107 @@
+#include "DrawList.h"
+
+#include "Game.h"
+
+#include "misc.h"
+
+void DrawList::Init() {
+	commands = (DrawCommand*) ecalloc(DRAW_LIST_CAPACITY, sizeof(*commands));
+	batch.Init();
+}
+
+void DrawList::Destroy() {
+	batch.Destroy();
+
+	if (commands) free(commands);
+	commands = nullptr;
+}
+
+void DrawList::AddSprite(SDL_Texture* texture, SDL_Surface* surface, SDL_Rect src, SDL_Rect dest,
+						 float angle, int flip, int layer, int depth) {
+	if (count == DRAW_LIST_CAPACITY) {
+		Flush();
+	}
+
+	DrawCommand* cmd = &commands[count];
+	cmd->texture = texture;
+	cmd->surface = surface;
+	cmd->src = src;
+	cmd->dest = dest;
+	cmd->angle = angle;
+	cmd->flip = flip;
+	cmd->color = {255, 255, 255, 255};
+	cmd->layer = layer;
+	cmd->depth = depth;
+	cmd->order = count;
+
+	count++;
+}
+
+void DrawList::AddRect(SDL_Rect rect, SDL_Color color, int layer, int depth) {
+	if (count == DRAW_LIST_CAPACITY) {
+		Flush();
+	}
+
+	DrawCommand* cmd = &commands[count];
+	*cmd = {};
+	cmd->dest = rect;
+	cmd->color = color;
+	cmd->layer = layer;
+	cmd->depth = depth;
+	cmd->order = count;
+
+	count++;
+}
+
+static int compare_commands(const void* a, const void* b) {
+	const DrawCommand* c1 = (const DrawCommand*) a;
+	const DrawCommand* c2 = (const DrawCommand*) b;
+
+	if (c1->layer != c2->layer) return (c1->layer < c2->layer) ? -1 : 1;
+	if (c1->depth != c2->depth) return (c1->depth < c2->depth) ? -1 : 1;
+
+	uintptr_t t1 = (uintptr_t) c1->texture;
+	uintptr_t t2 = (uintptr_t) c2->texture;
+	if (t1 != t2) return (t1 < t2) ? -1 : 1;
+
+	return c1->order - c2->order;
+}
+
+void DrawList::Flush() {
+	batches_last_flush = 0;
+	commands_last_flush = count;
+
+	if (count == 0) {
+		return;
+	}
+
+	qsort(commands, count, sizeof(*commands), compare_commands);
+
+	bool soft = GetSoftFramebuffer(game->renderer) != nullptr;
+	bool started = false;
+
+	for (int i = 0; i < count; i++) {
+		DrawCommand* cmd = &commands[i];
+
+		if (soft && cmd->surface) {
+			batch.Flush();
+			started = false;
+
+			SoftBlitSprite(GetSoftFramebuffer(game->renderer), cmd->surface, cmd->src, cmd->dest, cmd->angle, cmd->flip);
+			continue;
+		}
+
+		if (!started || cmd->texture != batch.texture) {
+			batch.Flush();
+			batch.Begin(cmd->texture);
+			batches_last_flush++;
+			started = true;
+		}
+
+		batch.Add(cmd->src, cmd->dest, cmd->flip, cmd->color, cmd->angle);
+	}
+
+	batch.Flush();
+
+	count = 0;
+}
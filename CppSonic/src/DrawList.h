@@ -0,0 +1,46 @@
+#pragma once
+
+#include "TileBatch.h"
+
+#define DRAW_LIST_CAPACITY 4096
+
+// Draw layers, lower ones are drawn first.
+enum {
+	DRAW_LAYER_OBJECTS,
+	DRAW_LAYER_PLAYER,
+};
+
+struct DrawCommand {
+	SDL_Texture* texture; // nullptr for a filled rect
+	SDL_Surface* surface; // if set, the software renderer blits this instead
+	SDL_Rect src;
+	SDL_Rect dest;
+	float angle;
+	int flip;
+	SDL_Color color;
+	int layer;
+	int depth;
+	int order;
+};
+
+// Sprites and rects pushed during a frame are sorted by layer, depth and
+// texture, and runs with the same texture go out as one SDL_RenderGeometry
+// call. Commands that tie keep the order they were pushed in.
+struct DrawList {
+	DrawCommand* commands;
+	int count;
+	TileBatch batch;
+
+	int batches_last_flush;
+	int commands_last_flush;
+
+	void Init();
+	void Destroy();
+
+	void AddSprite(SDL_Texture* texture, SDL_Surface* surface, SDL_Rect src, SDL_Rect dest,
+				   float angle, int flip, int layer, int depth = 0);
+	void AddRect(SDL_Rect rect, SDL_Color color, int layer, int depth = 0);
+
+	// Draws everything and empties the list. Also happens when the list is full.
+	void Flush();
+};
@@ -1,41 +1,32 @@
 #include "Font.h"
 
-#include <SDL_ttf.h>
+#include "SoftRenderer.h"
+#include <SDL_image.h>
 #include <stdlib.h> // for calloc
 
-SDL_Point DrawText(SDL_Renderer* renderer, Font* font, const char* text,
-				   int x, int y,
-				   int halign, int valign,
-				   SDL_Color color) {
-	if (!font) return {};
-	if (!font->texture) return {};
-	if (!font->glyphs) return {};
+static int max(int a, int b) { return (a > b) ? a : b; }
+static int min(int a, int b) { return (a < b) ? a : b; }
 
-	if (halign != HALIGN_LEFT || valign != VALIGN_TOP) {
-		SDL_Point m = MeasureText(font, text);
-		if (halign == HALIGN_CENTER) {
-			x -= m.x / 2;
-		} else if (halign == HALIGN_RIGHT) {
-			x -= m.x;
-		}
+void LayoutText(TextLayout* layout, Font* font, const char* text) {
+	layout->count = 0;
+	layout->size = {};
+	layout->end = {};
 
-		if (valign == VALIGN_MIDDLE) {
-			y -= m.y / 2;
-		} else if (valign == VALIGN_BOTTOM) {
-			y -= m.y;
-		}
-	}
+	if (!font) return;
+	if (!font->glyphs) return;
 
-	int text_x = x;
-	int text_y = y;
+	int text_x = 0;
+	int text_y = 0;
 
-	SDL_SetTextureColorMod(font->texture, color.r, color.g, color.b);
+	int text_w = 0;
+	int text_h = font->height;
 
 	for (const char* it = text; *it; it++) {
 		char ch = *it;
 		if (ch == '\n') {
-			text_x = x;
+			text_x = 0;
 			text_y += font->lineskip;
+			text_h = max(text_h, text_y + font->height);
 			continue;
 		}
 
@@ -45,7 +36,9 @@ SDL_Point DrawText(SDL_Renderer* renderer, Font* font, const char* text,
 
 		GlyphData* glyph = &font->glyphs[ch - 32];
 
-		if (ch != ' ') {
+		if (ch == ' ') {
+			text_w = max(text_w, text_x + glyph->advance);
+		} else {
 			SDL_Rect src = glyph->src;
 
 			SDL_Rect dest;
@@ -54,172 +47,238 @@ SDL_Point DrawText(SDL_Renderer* renderer, Font* font, const char* text,
 			dest.w = src.w;
 			dest.h = src.h;
 
-			SDL_RenderCopy(renderer, font->texture, &src, &dest);
+			if (layout->count == layout->capacity) {
+				int capacity = max(layout->capacity * 2, 64);
+				GlyphQuad* quads = (GlyphQuad*) calloc(capacity, sizeof(*quads));
+				if (!quads) {
+					break;
+				}
+				if (layout->quads) {
+					SDL_memcpy(quads, layout->quads, layout->count * sizeof(*quads));
+					free(layout->quads);
+				}
+				layout->quads = quads;
+				layout->capacity = capacity;
+			}
+
+			layout->quads[layout->count++] = {src, dest};
+
+			text_w = max(text_w, dest.x + dest.w);
 		}
-		
+
+		text_h = max(text_h, text_y + font->height);
 		text_x += glyph->advance;
 	}
 
-	return {text_x, text_y};
+	layout->size = {text_w, text_h};
+	layout->end = {text_x, text_y};
 }
 
-SDL_Point DrawTextShadow(SDL_Renderer* renderer, Font* font, const char* text,
-						 int x, int y,
-						 int halign, int valign,
-						 SDL_Color color) {
-	DrawText(renderer, font, text, x + 1, y + 1, halign, valign, {0, 0, 0, 255});
-	return DrawText(renderer, font, text, x, y, halign, valign, color);
+void DestroyTextLayout(TextLayout* layout) {
+	if (layout->quads) free(layout->quads);
+	*layout = {};
 }
 
-static int max(int a, int b) { return (a > b) ? a : b; }
-static int min(int a, int b) { return (a < b) ? a : b; }
-
-SDL_Point MeasureText(Font* font, const char* text) {
+SDL_Point DrawTextLayout(SDL_Renderer* renderer, Font* font, const TextLayout* layout,
+						 int x, int y,
+						 int halign, int valign,
+						 SDL_Color color, bool shadow) {
 	if (!font) return {};
 	if (!font->texture) return {};
-	if (!font->glyphs) return {};
 
-	int text_x = 0;
-	int text_y = 0;
+	if (halign == HALIGN_CENTER) {
+		x -= layout->size.x / 2;
+	} else if (halign == HALIGN_RIGHT) {
+		x -= layout->size.x;
+	}
 
-	int text_w = 0;
-	int text_h = font->height;
+	if (valign == VALIGN_MIDDLE) {
+		y -= layout->size.y / 2;
+	} else if (valign == VALIGN_BOTTOM) {
+		y -= layout->size.y;
+	}
 
-	for (const char* it = text; *it; it++) {
-		char ch = *it;
-		if (ch == '\n') {
-			text_x = 0;
-			text_y += font->lineskip;
-			text_h = max(text_h, text_y + font->height);
-			continue;
-		}
+	// only the color's rgb is used
+	color.a = 255;
+	SDL_Color shadow_color = {0, 0, 0, 255};
 
-		if (ch < 32 || ch > 126) {
-			ch = '?';
+	SoftFramebuffer* fb = font->surface ? GetSoftFramebuffer(renderer) : nullptr;
+
+	if (fb) {
+		for (int pass = shadow ? 0 : 1; pass < 2; pass++) {
+			int offset = (pass == 0) ? 1 : 0;
+			for (int i = 0; i < layout->count; i++) {
+				const GlyphQuad* quad = &layout->quads[i];
+				SoftBlitGlyph(fb, font->surface, quad->src,
+							  x + quad->dest.x + offset, y + quad->dest.y + offset,
+							  (pass == 0) ? shadow_color : color);
+			}
 		}
+	} else if (font->batch.vertices) {
+		// the color goes in the vertices
+		SDL_SetTextureColorMod(font->texture, 255, 255, 255);
+
+		font->batch.Begin(font->texture);
+		for (int pass = shadow ? 0 : 1; pass < 2; pass++) {
+			int offset = (pass == 0) ? 1 : 0;
+			for (int i = 0; i < layout->count; i++) {
+				const GlyphQuad* quad = &layout->quads[i];
+				SDL_Rect dest = quad->dest;
+				dest.x += x + offset;
+				dest.y += y + offset;
+				font->batch.Add(quad->src, dest, SDL_FLIP_NONE, (pass == 0) ? shadow_color : color);
+			}
+		}
+		font->batch.Flush();
+	}
 
-		GlyphData* glyph = &font->glyphs[ch - 32];
+	return {x + layout->end.x, y + layout->end.y};
+}
 
-		if (ch == ' ') {
-			text_w = max(text_w, text_x + glyph->advance);
-			text_h = max(text_h, text_y + font->height);
-		} else {
-			SDL_Rect src = glyph->src;
+SDL_Point DrawText(SDL_Renderer* renderer, Font* font, const char* text,
+				   int x, int y,
+				   int halign, int valign,
+				   SDL_Color color) {
+	if (!font) return {};
+	if (!font->texture) return {};
+	if (!font->glyphs) return {};
 
-			SDL_Rect dest;
-			dest.x = text_x + glyph->xoffset;
-			dest.y = text_y + glyph->yoffset;
-			dest.w = src.w;
-			dest.h = src.h;
+	LayoutText(&font->layout, font, text);
+	return DrawTextLayout(renderer, font, &font->layout, x, y, halign, valign, color);
+}
 
-			text_w = max(text_w, dest.x + dest.w);
-			text_h = max(text_h, text_y + font->height);
-		}
+SDL_Point DrawTextShadow(SDL_Renderer* renderer, Font* font, const char* text,
+						 int x, int y,
+						 int halign, int valign,
+						 SDL_Color color) {
+	if (!font) return {};
+	if (!font->texture) return {};
+	if (!font->glyphs) return {};
 
-		text_x += glyph->advance;
-	}
+	LayoutText(&font->layout, font, text);
+	return DrawTextLayout(renderer, font, &font->layout, x, y, halign, valign, color, true);
+}
+
+SDL_Point MeasureText(Font* font, const char* text) {
+	if (!font) return {};
+	if (!font->texture) return {};
+	if (!font->glyphs) return {};
 
-	return {text_w, text_h};
+	LayoutText(&font->layout, font, text);
+	return font->layout.size;
 }
 
-void LoadFontFromFileTTF(Font* font, const char* fname, int ptsize, SDL_Renderer* renderer) {
-	TTF_Font* ttf_font = nullptr;
+bool LoadBakedFont(Font* font, const char* fname, const char* atlas_fname, SDL_Renderer* renderer) {
+	bool result = false;
+
+	SDL_RWops* f = nullptr;
 	SDL_Surface* atlas_surf = nullptr;
 
 	{
-		ttf_font = TTF_OpenFont(fname, ptsize);
+		f = SDL_RWFromFile(fname, "rb");
+
+		if (!f) {
+			goto out;
+		}
 
-		if (!ttf_font) {
+		BakedFontHeader header = {};
+		SDL_RWread(f, &header, sizeof(header), 1);
+
+		if (header.magic != BAKED_FONT_MAGIC || header.glyph_count != FONT_GLYPH_COUNT) {
 			goto out;
 		}
 
-		font->ptsize = ptsize;
-		font->glyphs = (GlyphData*) calloc(95, sizeof(*font->glyphs));
+		font->ptsize = header.ptsize;
+		font->height = header.height;
+		font->ascent = header.ascent;
+		font->descent = header.descent;
+		font->lineskip = header.lineskip;
+		font->glyphs = (GlyphData*) calloc(FONT_GLYPH_COUNT, sizeof(*font->glyphs));
 
 		if (!font->glyphs) {
 			goto out;
 		}
 
-		int atlas_width = 256;
-		int atlas_height = 256;
+		if (SDL_RWread(f, font->glyphs, sizeof(*font->glyphs), FONT_GLYPH_COUNT) != FONT_GLYPH_COUNT) {
+			goto out;
+		}
 
-		atlas_surf = SDL_CreateRGBSurfaceWithFormat(0, atlas_width, atlas_height, 32, SDL_PIXELFORMAT_ARGB8888);
+		atlas_surf = IMG_Load(atlas_fname);
 
 		if (!atlas_surf) {
 			goto out;
 		}
 
-		font->height = TTF_FontHeight(ttf_font);
-		font->ascent = TTF_FontAscent(ttf_font);
-		font->descent = TTF_FontDescent(ttf_font);
-		font->lineskip = TTF_FontLineSkip(ttf_font);
+		font->texture = SDL_CreateTextureFromSurface(renderer, atlas_surf);
 
-		{
-			int minx;
-			int maxx;
-			int miny;
-			int maxy;
-			int advance;
-			TTF_GlyphMetrics(ttf_font, ' ', &minx, &maxx, &miny, &maxy, &advance);
+		if (!font->texture) {
+			goto out;
+		}
 
-			font->glyphs[0].advance = advance;
+		if (GetSoftFramebuffer(renderer)) {
+			font->surface = SDL_ConvertSurfaceFormat(atlas_surf, SDL_PIXELFORMAT_ARGB8888, 0);
 		}
 
-		int x = 0;
-		int y = 0;
+		font->batch.Init();
 
-		for (unsigned char ch = 33; ch <= 126; ch++) {
-			SDL_Surface* glyph_surf = TTF_RenderGlyph_Blended(ttf_font, ch, {255, 255, 255, 255});
+		result = true;
+	}
 
-			//SDL_GetPixelFormatName(glyph_surf->format->format);
+out:
+	if (atlas_surf) SDL_FreeSurface(atlas_surf);
+	if (f) SDL_RWclose(f);
 
-			int minx;
-			int maxx;
-			int miny;
-			int maxy;
-			int advance;
-			TTF_GlyphMetrics(ttf_font, ch, &minx, &maxx, &miny, &maxy, &advance);
+	if (!result) {
+		DestroyFont(font);
+	}
 
-			if (x + maxx - minx > atlas_surf->w) {
-				y += font->lineskip;
-				x = 0;
-			}
+	return result;
+}
 
-			SDL_Rect src{minx, font->ascent - maxy, maxx - minx, maxy - miny};
-			SDL_Rect dest{x, y, maxx - minx, maxy - miny};
-			SDL_BlitSurface(glyph_surf, &src, atlas_surf, &dest);
+bool SaveBakedFont(const Font* font, SDL_Surface* atlas, const char* fname, const char* atlas_fname) {
+	if (!font->glyphs) {
+		return false;
+	}
 
-			int w = maxx - minx;
-			int h = maxy - miny;
-			int xoffset = minx;
-			int yoffset = font->ascent - maxy;
+	if (IMG_SavePNG(atlas, atlas_fname) != 0) {
+		return false;
+	}
 
-			font->glyphs[ch - 32].src = {x, y, w, h};
-			font->glyphs[ch - 32].xoffset = xoffset;
-			font->glyphs[ch - 32].yoffset = yoffset;
-			font->glyphs[ch - 32].advance = advance;
+	SDL_RWops* f = SDL_RWFromFile(fname, "wb");
 
-			x += maxx - minx;
+	if (!f) {
+		return false;
+	}
 
-			SDL_FreeSurface(glyph_surf);
-		}
+	BakedFontHeader header = {};
+	header.magic = BAKED_FONT_MAGIC;
+	header.ptsize = font->ptsize;
+	header.height = font->height;
+	header.ascent = font->ascent;
+	header.descent = font->descent;
+	header.lineskip = font->lineskip;
+	header.glyph_count = FONT_GLYPH_COUNT;
 
-		font->texture = SDL_CreateTextureFromSurface(renderer, atlas_surf);
+	bool result = (SDL_RWwrite(f, &header, sizeof(header), 1) == 1
+				   && SDL_RWwrite(f, font->glyphs, sizeof(*font->glyphs), FONT_GLYPH_COUNT) == FONT_GLYPH_COUNT);
 
-		if (!font->texture) {
-			goto out;
-		}
+	if (SDL_RWclose(f) != 0) {
+		result = false;
 	}
 
-out:
-	if (atlas_surf) SDL_FreeSurface(atlas_surf);
-	if (ttf_font) TTF_CloseFont(ttf_font);
+	return result;
 }
 
 void DestroyFont(Font* font) {
 	if (font->texture) SDL_DestroyTexture(font->texture);
 	font->texture = nullptr;
 
+	if (font->surface) SDL_FreeSurface(font->surface);
+	font->surface = nullptr;
+
 	if (font->glyphs) free(font->glyphs);
 	font->glyphs = nullptr;
+
+	font->batch.Destroy();
+	DestroyTextLayout(&font->layout);
 }
@@ -2,6 +2,24 @@
 
 #include <SDL.h>
 
+#include "TileBatch.h"
+
+// Fonts are baked ahead of time by the editor (--bake-font) into an atlas PNG
+// and a file with this header followed by the glyph table, so loading one is
+// an image decode and a read.
+#define BAKED_FONT_MAGIC int(0xC5464E54)
+#define FONT_GLYPH_COUNT 95 // 32..126
+
+struct BakedFontHeader {
+	int magic;
+	int ptsize;
+	int height;
+	int ascent;
+	int descent;
+	int lineskip;
+	int glyph_count;
+};
+
 struct GlyphData {
 	SDL_Rect src;
 	int xoffset;
@@ -9,14 +27,33 @@ struct GlyphData {
 	int advance;
 };
 
+// A string parsed once: where every glyph goes, relative to the top left of
+// the text. Drawing, measuring and the shadow all use the same list.
+struct GlyphQuad {
+	SDL_Rect src;
+	SDL_Rect dest;
+};
+
+struct TextLayout {
+	GlyphQuad* quads;
+	int count;
+	int capacity;
+	SDL_Point size; // what MeasureText returns
+	SDL_Point end;  // where the next glyph would go
+};
+
 struct Font {
 	SDL_Texture* texture;
+	SDL_Surface* surface; // ARGB8888, only kept for the software renderer
 	int ptsize;
 	int height;
 	int ascent;
 	int descent;
 	int lineskip;
 	GlyphData* glyphs; // 32..126
+
+	TextLayout layout; // reused by DrawText and MeasureText
+	TileBatch batch;   // all glyphs of a call go in one SDL_RenderGeometry
 };
 
 enum {
@@ -31,10 +68,12 @@ enum {
 	VALIGN_BOTTOM
 };
 
-// Expects SDL_ttf (and SDL) to be initialized.
-void LoadFontFromFileTTF(Font* font, const char* fname, int ptsize, SDL_Renderer* renderer);
+bool LoadBakedFont(Font* font, const char* fname, const char* atlas_fname, SDL_Renderer* renderer);
 void DestroyFont(Font* font);
 
+// The metrics and glyphs of font, with the glyphs' pixels in atlas.
+bool SaveBakedFont(const Font* font, SDL_Surface* atlas, const char* fname, const char* atlas_fname);
+
 SDL_Point DrawText(SDL_Renderer* renderer, Font* font, const char* text,
 				   int x, int y,
 				   int halign = 0, int valign = 0,
@@ -46,3 +85,13 @@ SDL_Point DrawTextShadow(SDL_Renderer* renderer, Font* font, const char* text,
 						 SDL_Color color = {255, 255, 255, 255});
 
 SDL_Point MeasureText(Font* font, const char* text);
+
+// Keeps the quads array, it grows as needed.
+void LayoutText(TextLayout* layout, Font* font, const char* text);
+void DestroyTextLayout(TextLayout* layout);
+
+// Returns where the next glyph would go, like DrawText.
+SDL_Point DrawTextLayout(SDL_Renderer* renderer, Font* font, const TextLayout* layout,
+						 int x, int y,
+						 int halign = 0, int valign = 0,
+						 SDL_Color color = {255, 255, 255, 255}, bool shadow = false);
@@ -0,0 +1,187 @@
+#include "FrameCapture.h"
+
+#include "misc.h"
+#include "mathh.h"
+#include "stb_sprintf.h"
+
+// BT.601 full range, like C420jpeg expects, in 8.8 fixed point
+static void argb_to_yuv420(const uint32_t* pixels, int w, int h, uint8_t* yuv) {
+	uint8_t* y_plane = yuv;
+	uint8_t* u_plane = yuv + w * h;
+	uint8_t* v_plane = u_plane + (w / 2) * (h / 2);
+
+	for (int i = 0; i < w * h; i++) {
+		int r = (pixels[i] >> 16) & 0xFF;
+		int g = (pixels[i] >>  8) & 0xFF;
+		int b = (pixels[i] >>  0) & 0xFF;
+		y_plane[i] = uint8_t((77 * r + 150 * g + 29 * b + 128) >> 8);
+	}
+
+	for (int y = 0; y < h / 2; y++) {
+		for (int x = 0; x < w / 2; x++) {
+			// average of the 2x2 block
+			int r = 0;
+			int g = 0;
+			int b = 0;
+			for (int i = 0; i < 4; i++) {
+				uint32_t p = pixels[(x * 2 + (i & 1)) + (y * 2 + (i >> 1)) * w];
+				r += (p >> 16) & 0xFF;
+				g += (p >>  8) & 0xFF;
+				b += (p >>  0) & 0xFF;
+			}
+			r /= 4;
+			g /= 4;
+			b /= 4;
+
+			int u = ((-43 * r -  85 * g + 128 * b + 128) >> 8) + 128;
+			int v = ((128 * r - 107 * g -  21 * b + 128) >> 8) + 128;
+			u_plane[x + y * (w / 2)] = uint8_t(clamp(u, 0, 255));
+			v_plane[x + y * (w / 2)] = uint8_t(clamp(v, 0, 255));
+		}
+	}
+}
+
+static int capture_thread(void* userdata) {
+	FrameCapture* capture = (FrameCapture*) userdata;
+
+	int w = capture->w;
+	int h = capture->h;
+	size_t yuv_size = w * h + 2 * (w / 2) * (h / 2);
+
+	while (true) {
+		SDL_LockMutex(capture->mutex);
+		while (capture->queue_count == 0 && !capture->stopping) {
+			SDL_CondWait(capture->cond, capture->mutex);
+		}
+
+		// the queue is drained before stopping
+		if (capture->queue_count == 0) {
+			SDL_UnlockMutex(capture->mutex);
+			break;
+		}
+
+		int buffer = capture->queue[capture->queue_head];
+		capture->queue_head = (capture->queue_head + 1) % FRAME_CAPTURE_BUFFERS;
+		capture->queue_count--;
+		SDL_UnlockMutex(capture->mutex);
+
+		if (!capture->write_failed) {
+			argb_to_yuv420(capture->buffers[buffer], w, h, capture->yuv);
+
+			const char frame_header[] = "FRAME\n";
+			bool ok = (SDL_RWwrite(capture->file, frame_header, 1, sizeof(frame_header) - 1) == sizeof(frame_header) - 1
+					   && SDL_RWwrite(capture->file, capture->yuv, 1, yuv_size) == yuv_size);
+			if (!ok) {
+				capture->write_failed = true;
+			}
+		}
+
+		SDL_LockMutex(capture->mutex);
+		capture->free_buffers[capture->free_count++] = buffer;
+		SDL_UnlockMutex(capture->mutex);
+	}
+
+	return 0;
+}
+
+bool StartFrameCapture(FrameCapture* capture, const char* fname, int w, int h, int fps) {
+	*capture = {};
+
+	// 4:2:0 needs even sizes
+	w &= ~1;
+	h &= ~1;
+
+	capture->file = SDL_RWFromFile(fname, "wb");
+	if (!capture->file) {
+		return false;
+	}
+
+	char header[100];
+	int header_size = stb_snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", w, h, fps);
+	SDL_RWwrite(capture->file, header, 1, header_size);
+
+	capture->w = w;
+	capture->h = h;
+
+	for (int i = 0; i < FRAME_CAPTURE_BUFFERS; i++) {
+		capture->buffers[i] = (uint32_t*) ecalloc(w * h, sizeof(uint32_t));
+		capture->free_buffers[capture->free_count++] = i;
+	}
+	capture->yuv = (uint8_t*) ecalloc(w * h * 3 / 2, 1);
+
+	capture->mutex = SDL_CreateMutex();
+	capture->cond = SDL_CreateCond();
+	capture->thread = SDL_CreateThread(capture_thread, "frame capture", capture);
+
+	if (!capture->thread) {
+		StopFrameCapture(capture);
+		return false;
+	}
+
+	return true;
+}
+
+void CaptureFrame(FrameCapture* capture, SDL_Renderer* renderer) {
+	if (!capture->file) {
+		return;
+	}
+
+	double t = GetTime();
+
+	SDL_LockMutex(capture->mutex);
+	int buffer = -1;
+	if (capture->free_count > 0) {
+		buffer = capture->free_buffers[--capture->free_count];
+	}
+	SDL_UnlockMutex(capture->mutex);
+
+	if (buffer == -1) {
+		capture->frames_dropped++;
+	} else {
+		SDL_Rect rect = {0, 0, capture->w, capture->h};
+		SDL_RenderReadPixels(renderer, &rect, SDL_PIXELFORMAT_ARGB8888, capture->buffers[buffer], capture->w * sizeof(uint32_t));
+
+		SDL_LockMutex(capture->mutex);
+		capture->queue[(capture->queue_head + capture->queue_count) % FRAME_CAPTURE_BUFFERS] = buffer;
+		capture->queue_count++;
+		SDL_CondSignal(capture->cond);
+		SDL_UnlockMutex(capture->mutex);
+
+		capture->frames_captured++;
+	}
+
+	capture->capture_time += (GetTime() - t) * 1000.0;
+}
+
+void StopFrameCapture(FrameCapture* capture) {
+	if (!capture->file) {
+		return;
+	}
+
+	if (capture->thread) {
+		SDL_LockMutex(capture->mutex);
+		capture->stopping = true;
+		SDL_CondSignal(capture->cond);
+		SDL_UnlockMutex(capture->mutex);
+
+		SDL_WaitThread(capture->thread, nullptr);
+
+		int frames = capture->frames_captured + capture->frames_dropped;
+		SDL_Log("Captured %d frames, dropped %d, %fms per frame on the main thread.%s",
+				capture->frames_captured, capture->frames_dropped,
+				capture->capture_time / double(max(frames, 1)),
+				capture->write_failed ? " Writing failed." : "");
+	}
+
+	if (capture->cond) SDL_DestroyCond(capture->cond);
+	if (capture->mutex) SDL_DestroyMutex(capture->mutex);
+
+	if (capture->yuv) free(capture->yuv);
+	for (int i = 0; i < FRAME_CAPTURE_BUFFERS; i++) {
+		if (capture->buffers[i]) free(capture->buffers[i]);
+	}
+
+	SDL_RWclose(capture->file);
+
+	*capture = {};
+}
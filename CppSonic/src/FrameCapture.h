@@ -0,0 +1,44 @@
+#pragma once
+
+#include <SDL.h>
+#include <stdint.h>
+
+#define FRAME_CAPTURE_BUFFERS 8
+
+// Records the game to a Y4M file. The main thread only reads the frame back
+// into a free buffer and queues it; a worker thread converts it to YUV 4:2:0
+// and writes it. If every buffer is still waiting for the disk, the frame is
+// dropped instead of stalling the game.
+struct FrameCapture {
+	SDL_RWops* file;
+	int w;
+	int h;
+
+	uint32_t* buffers[FRAME_CAPTURE_BUFFERS]; // ARGB8888
+	uint8_t* yuv; // only used by the worker
+
+	// guarded by mutex
+	int free_buffers[FRAME_CAPTURE_BUFFERS];
+	int free_count;
+	int queue[FRAME_CAPTURE_BUFFERS];
+	int queue_head;
+	int queue_count;
+	bool stopping;
+
+	SDL_mutex* mutex;
+	SDL_cond* cond;
+	SDL_Thread* thread;
+
+	int frames_captured;
+	int frames_dropped;
+	bool write_failed;
+	double capture_time; // ms spent on the main thread
+};
+
+bool StartFrameCapture(FrameCapture* capture, const char* fname, int w, int h, int fps);
+
+// Reads the renderer's current target, which has to be w by h.
+void CaptureFrame(FrameCapture* capture, SDL_Renderer* renderer);
+
+// Waits for the queued frames to be written and closes the file.
+void StopFrameCapture(FrameCapture* capture);
@@ -12,55 +12,223 @@ Game* game;
 void Game::Init() {
 	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_VERBOSE);
 
-	if (SDL_Init(SDL_INIT_VIDEO
-				 | SDL_INIT_AUDIO) != 0) {
+	Uint32 subsystems = offscreen ? SDL_INIT_EVENTS : (SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+	if (SDL_Init(subsystems) != 0) {
 		ErrorMessageBox("SDL couldn't initialize: %s", SDL_GetError());
 		exit(1);
 	}
 
 	IMG_Init(IMG_INIT_PNG);
 
-	window = SDL_CreateWindow("CppSonic",
-							  SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-							  GAME_W, GAME_H,
-							  SDL_WINDOW_RESIZABLE);
+	if (offscreen) {
+		if (!CreateSoftFramebuffer(&framebuffer, GAME_W, GAME_H)) {
+			ErrorMessageBox("Couldn't create framebuffer: %s", SDL_GetError());
+			exit(1);
+		}
+
+		readback = (render_test.golden_prefix != nullptr);
+
+		if (readback) {
+			if (SDL_InitSubSystem(SDL_INIT_VIDEO) == 0) {
+				window = SDL_CreateWindow("CppSonic",
+										  SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+										  GAME_W, GAME_H,
+										  SDL_WINDOW_HIDDEN);
+			}
+
+			if (window) {
+				renderer = SDL_CreateRenderer(window, -1, 0);
+			} else {
+				renderer = SDL_CreateSoftwareRenderer(framebuffer.surface);
+			}
 
-	renderer = SDL_CreateRenderer(window, -1, 0);
+			game_texture = SDL_CreateTexture(renderer,
+											 SDL_PIXELFORMAT_ARGB8888,
+											 SDL_TEXTUREACCESS_TARGET,
+											 GAME_W, GAME_H);
+
+			// goldens only match frames drawn by the same backend
+			SDL_RendererInfo info = {};
+			SDL_GetRendererInfo(renderer, &info);
+			SDL_Log("Reading frames back from the %s renderer.", info.name);
+		} else {
+			// SDL's software renderer draws everything that isn't blitted directly
+			renderer = SDL_CreateSoftwareRenderer(framebuffer.surface);
+			BindSoftFramebuffer(renderer, &framebuffer);
+		}
+	} else {
+		window = SDL_CreateWindow("CppSonic",
+								  SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+								  GAME_W, GAME_H,
+								  SDL_WINDOW_RESIZABLE);
+
+		renderer = SDL_CreateRenderer(window, -1, 0);
+
+		game_texture = SDL_CreateTexture(renderer,
+										 SDL_PIXELFORMAT_ARGB8888,
+										 SDL_TEXTUREACCESS_TARGET,
+										 GAME_W, GAME_H);
+	}
 
 	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
 
-	game_texture = SDL_CreateTexture(renderer,
-									 SDL_PIXELFORMAT_ARGB8888,
-									 SDL_TEXTUREACCESS_TARGET,
-									 GAME_W, GAME_H);
+	if (replay_path) {
+		if (!LoadReplay(&replay, replay_path)) {
+			ErrorMessageBox("Couldn't load replay %s.", replay_path);
+			exit(1);
+		}
+		replay_playing = true;
+	}
+
+	if (offscreen_frames == 0) {
+		if (render_test.golden_prefix) {
+			offscreen_frames = GetRenderTestLastFrame(&render_test);
+		} else if (replay_playing) {
+			offscreen_frames = replay.frame_count;
+		} else {
+			offscreen_frames = 600;
+		}
+	}
 
 	load_all_assets();
 
 	world = &world_instance;
 	world->Init();
+
+	if (capture_path) {
+		if (!StartFrameCapture(&capture, capture_path, GAME_W, GAME_H, GAME_FPS)) {
+			SDL_Log("Couldn't start capturing to %s.", capture_path);
+		}
+	}
 }
 
 void Game::Quit() {
+	StopFrameCapture(&capture);
+
 	switch (state) {
 		case GameState::PLAYING: world->Quit(); break;
 	}
 
 	free_all_assets();
 
-	SDL_DestroyTexture(game_texture);
+	if (record_path) {
+		if (!SaveReplay(&recording, record_path)) {
+			SDL_Log("Couldn't save replay %s.", record_path);
+		}
+	}
+	DestroyReplay(&recording);
+	DestroyReplay(&replay);
+
+	DestroyTextCache(&text_cache);
+
+	if (game_texture) SDL_DestroyTexture(game_texture);
 	SDL_DestroyRenderer(renderer);
-	SDL_DestroyWindow(window);
+	if (window) SDL_DestroyWindow(window);
+
+	DestroySoftFramebuffer(&framebuffer);
 
 	IMG_Quit();
 	SDL_Quit();
 }
 
+void Game::ParseArgs(int argc, char* argv[]) {
+	for (int i = 1; i < argc; i++) {
+		if (SDL_strcmp(argv[i], "--offscreen") == 0) {
+			offscreen = true;
+		} else if (SDL_strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			offscreen_frames = SDL_atoi(argv[++i]);
+		} else if (SDL_strcmp(argv[i], "--screenshot") == 0 && i + 1 < argc) {
+			screenshot_path = argv[++i];
+		} else if (SDL_strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			replay_path = argv[++i];
+		} else if (SDL_strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			record_path = argv[++i];
+		} else if (SDL_strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+			render_test.golden_prefix = argv[++i];
+		} else if (SDL_strcmp(argv[i], "--golden-frames") == 0 && i + 1 < argc) {
+			ParseRenderTestFrames(&render_test, argv[++i]);
+		} else if (SDL_strcmp(argv[i], "--update-golden") == 0) {
+			render_test.update = true;
+		} else if (SDL_strcmp(argv[i], "--render-tests") == 0 && i + 1 < argc) {
+			render_test_suite = argv[++i];
+		} else if (SDL_strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+			capture_path = argv[++i];
+		} else if (SDL_strcmp(argv[i], "--tile-layout") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			if (SDL_strcmp(name, "row") == 0) {
+				tile_layout = TileMapLayout::ROW_MAJOR;
+			} else if (SDL_strcmp(name, "blocked") == 0) {
+				tile_layout = TileMapLayout::BLOCKED;
+			} else {
+				SDL_Log("Unknown tile layout %s, expected row or blocked.", name);
+			}
+		} else if (SDL_strcmp(argv[i], "--collision-layout") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			if (SDL_strcmp(name, "interleaved") == 0) {
+				collision_layout = TileCollisionLayout::INTERLEAVED;
+			} else if (SDL_strcmp(name, "split") == 0) {
+				collision_layout = TileCollisionLayout::SPLIT;
+			} else {
+				SDL_Log("Unknown collision layout %s, expected interleaved or split.", name);
+			}
+		} else if (SDL_strcmp(argv[i], "--bench-sensors") == 0) {
+			bench_sensors = true;
+		}
+	}
+
+	if (bench_sensors) {
+		if (!replay_path) {
+			ErrorMessageBox("--bench-sensors needs a --replay to drive the player.");
+			exit(1);
+		}
+		offscreen = true;
+	}
+}
+
 void Game::Run() {
+	if (offscreen) {
+		RunOffscreen();
+		return;
+	}
+
 	while (!quit) {
 		Frame();
 	}
 }
 
+void Game::RunOffscreen() {
+	double t = GetTime();
+
+	int frame = 0;
+	for (; frame < offscreen_frames && !quit; frame++) {
+		Frame();
+
+		if (render_test.golden_prefix) {
+			CheckRenderTestFrame(&render_test, framebuffer.surface, frame + 1, draw_took);
+		}
+	}
+
+	double took = GetTime() - t;
+	SDL_Log("Rendered %d frames offscreen in %fs (%f fps).", frame, took, double(frame) / took);
+
+	if (render_test.golden_prefix) {
+		ReportRenderTest(&render_test);
+		if (render_test.failures > 0) {
+			exit_code = 1;
+		}
+	}
+
+	if (bench_sensors) {
+		world->BenchmarkSensors();
+	}
+
+	if (screenshot_path) {
+		if (IMG_SavePNG(framebuffer.surface, screenshot_path) != 0) {
+			SDL_Log("Couldn't save %s: %s", screenshot_path, IMG_GetError());
+		}
+	}
+}
+
 void Game::Frame() {
 	double t = GetTime();
 	
@@ -81,6 +249,12 @@ void Game::Frame() {
 					break;
 				}
 
+				case SDL_RENDER_TARGETS_RESET: {
+					world->InvalidateTileGraphics();
+					InvalidateTextCache(&text_cache);
+					break;
+				}
+
 				case SDL_KEYDOWN: {
 					SDL_Scancode scancode = ev.key.keysym.scancode;
 					if (0 <= scancode && scancode < ArrayLength(key_pressed)) {
@@ -98,6 +272,19 @@ void Game::Frame() {
 							frame_advance = false;
 							break;
 						}
+
+						case SDL_SCANCODE_F8: {
+							if (capture.file) {
+								StopFrameCapture(&capture);
+							} else {
+								char fname[64];
+								stb_snprintf(fname, sizeof(fname), "capture_%u.y4m", SDL_GetTicks());
+								if (StartFrameCapture(&capture, fname, GAME_W, GAME_H, GAME_FPS)) {
+									SDL_Log("Capturing to %s.", fname);
+								}
+							}
+							break;
+						}
 					}
 					break;
 				}
@@ -114,6 +301,10 @@ void Game::Frame() {
 	}
 
 #ifndef __EMSCRIPTEN__
+	if (offscreen) {
+		return;
+	}
+
 	t = GetTime();
 	double time_left = frame_end_time - t;
 	if (time_left > 0.0) {
@@ -145,6 +336,23 @@ void Game::Update(float delta) {
 void Game::Draw(float delta) {
 	double t = GetTime();
 
+	// offscreen there's no screen and no HUD, just the game
+	if (offscreen && !readback) {
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+		SDL_RenderClear(renderer);
+
+		switch (state) {
+			case GameState::PLAYING: world->Draw(delta); break;
+		}
+
+		SDL_RenderFlush(renderer);
+
+		CaptureFrame(&capture, renderer);
+
+		draw_took = (GetTime() - t) * 1000.0;
+		return;
+	}
+
 	// draw game to game texture
 	SDL_SetRenderTarget(renderer, game_texture);
 	{
@@ -154,6 +362,8 @@ void Game::Draw(float delta) {
 		switch (state) {
 			case GameState::PLAYING: world->Draw(delta); break;
 		}
+
+		CaptureFrame(&capture, renderer);
 	}
 
 	// draw game texture and other stuff to screen
@@ -166,28 +376,50 @@ void Game::Draw(float delta) {
 		{
 			SDL_RenderCopy(renderer, game_texture, nullptr, nullptr);
 
-			int mouse_x_window;
-			int mouse_y_window;
-			SDL_GetMouseState(&mouse_x_window, &mouse_y_window);
-			SDL_RenderWindowToLogical(renderer, mouse_x_window, mouse_y_window, &mouse_x, &mouse_y);
+			// offscreen the mouse stays at 0,0
+			if (!offscreen) {
+				int mouse_x_window;
+				int mouse_y_window;
+				SDL_GetMouseState(&mouse_x_window, &mouse_y_window);
+				SDL_RenderWindowToLogical(renderer, mouse_x_window, mouse_y_window, &mouse_x, &mouse_y);
+			}
 		}
 		SDL_RenderSetLogicalSize(renderer, 0, 0);
 
 		int draw_x = 0;
 		int draw_y = 0;
 
+		BeginTextCacheFrame(&text_cache);
+
+		// The labels never change and are drawn from the text cache. Values that
+		// change every frame are drawn directly, the others are cached too.
+		auto draw_line = [&](const char* label, const char* value, bool value_changes) {
+			SDL_Point end = DrawTextCached(&text_cache, renderer, &fnt_cp437, label, draw_x, draw_y);
+			if (value_changes) {
+				DrawTextShadow(renderer, &fnt_cp437, value, end.x, draw_y);
+			} else {
+				DrawTextCached(&text_cache, renderer, &fnt_cp437, value, end.x, draw_y);
+			}
+			draw_y += fnt_cp437.lineskip;
+		};
+
 		{
-			char buf[100];
-			stb_snprintf(buf,
-						 sizeof(buf),
-						 "%ffps\n"
-						 "update: %fms\n"
-						 "draw: %fms\n"
-						 "\n",
-						 fps,
-						 update_took,
-						 draw_took);
-			draw_y = DrawTextShadow(renderer, &fnt_cp437, buf, draw_x, draw_y).y;
+			char buf[3][32];
+			stb_snprintf(buf[0], sizeof(buf[0]), "%ffps", fps);
+			stb_snprintf(buf[1], sizeof(buf[1]), "%fms", update_took);
+			stb_snprintf(buf[2], sizeof(buf[2]), "%fms", draw_took);
+
+			// timings differ every run, they would never match a golden image
+			if (offscreen) {
+				for (int i = 0; i < 3; i++) {
+					stb_snprintf(buf[i], sizeof(buf[i]), "-");
+				}
+			}
+
+			draw_line("",         buf[0], true);
+			draw_line("update: ", buf[1], true);
+			draw_line("draw: ",   buf[2], true);
+			draw_y += fnt_cp437.lineskip;
 		}
 
 		switch (state) {
@@ -199,59 +431,64 @@ void Game::Draw(float delta) {
 				tile_x = clamp(tile_x, 0, world->tilemap.width  - 1);
 				tile_y = clamp(tile_y, 0, world->tilemap.height - 1);
 
-				Tile tile = world->tilemap.GetTileA(tile_x, tile_y);
+				Tile tile = world->tilemap.GetTile(tile_x, tile_y, 0);
 				uint8_t* height = world->tileset.GetTileHeight(tile.index);
 				float angle = world->tileset.GetTileAngle(tile.index);
 
-				char buf[200];
-				stb_snprintf(buf,
-							 sizeof(buf),
-							 "x: %f\n"
-							 "y: %f\n"
-							 "xspeed: %f\n"
-							 "yspeed: %f\n"
-							 "ground speed: %f\n"
-							 "ground angle: %f\n"
-							 "%s\n"
-							 "\n",
-							 world->player.x,
-							 world->player.y,
-							 world->player.xspeed,
-							 world->player.yspeed,
-							 world->player.ground_speed,
-							 world->player.ground_angle,
-							 anim_get_name(world->player.anim));
-				draw_y = DrawTextShadow(renderer, &fnt_cp437, buf, draw_x, draw_y).y;
+				Player* p = &world->player;
+
+				{
+					char buf[6][32];
+					stb_snprintf(buf[0], sizeof(buf[0]), "%f", p->x);
+					stb_snprintf(buf[1], sizeof(buf[1]), "%f", p->y);
+					stb_snprintf(buf[2], sizeof(buf[2]), "%f", p->xspeed);
+					stb_snprintf(buf[3], sizeof(buf[3]), "%f", p->yspeed);
+					stb_snprintf(buf[4], sizeof(buf[4]), "%f", p->ground_speed);
+					stb_snprintf(buf[5], sizeof(buf[5]), "%f", p->ground_angle);
+
+					draw_line("x: ",            buf[0], true);
+					draw_line("y: ",            buf[1], true);
+					draw_line("xspeed: ",       buf[2], true);
+					draw_line("yspeed: ",       buf[3], true);
+					draw_line("ground speed: ", buf[4], true);
+					draw_line("ground angle: ", buf[5], true);
+					draw_line("", anim_get_name(p->anim), false);
+					draw_y += fnt_cp437.lineskip;
+				}
 
 				if (world->debug) {
-					char buf[200];
-					stb_snprintf(buf,
-								 sizeof(buf),
-								 "mouse x: %d\n"
-								 "mouse y: %d\n"
-								 "mouse tile: %d\n"
-								 "angle: %f\n"
-								 "hflip: %d vflip: %d\n"
-								 "top solid: %d\n"
-								 "left right bottom solid: %d\n",
-								 tile_x,
-								 tile_y,
-								 tile.index,
-								 angle,
-								 tile.hflip, tile.vflip,
-								 tile.top_solid,
-								 tile.left_right_bottom_solid);
-					draw_y = DrawTextShadow(renderer, &fnt_cp437, buf, draw_x, draw_y).y;
+					char buf[9][32];
+					stb_snprintf(buf[0], sizeof(buf[0]), "%d", tile_x);
+					stb_snprintf(buf[1], sizeof(buf[1]), "%d", tile_y);
+					stb_snprintf(buf[2], sizeof(buf[2]), "%d", tile.index);
+					stb_snprintf(buf[3], sizeof(buf[3]), "%f", angle);
+					stb_snprintf(buf[4], sizeof(buf[4]), "%d", tile.hflip);
+					stb_snprintf(buf[5], sizeof(buf[5]), "%d", tile.vflip);
+					stb_snprintf(buf[6], sizeof(buf[6]), "%d", tile.top_solid);
+					stb_snprintf(buf[7], sizeof(buf[7]), "%d", tile.left_right_bottom_solid);
+					stb_snprintf(buf[8], sizeof(buf[8]), "%d in %d batches",
+								 world->draw_list.commands_last_flush,
+								 world->draw_list.batches_last_flush);
+
+					draw_line("mouse x: ",                 buf[0], false);
+					draw_line("mouse y: ",                 buf[1], false);
+					draw_line("mouse tile: ",              buf[2], false);
+					draw_line("angle: ",                   buf[3], false);
+					draw_line("hflip: ",                   buf[4], false);
+					draw_line("vflip: ",                   buf[5], false);
+					draw_line("top solid: ",               buf[6], false);
+					draw_line("left right bottom solid: ", buf[7], false);
+					draw_line("sprites: ",                 buf[8], false);
 
 					if (height) {
 						char buf[100];
 						stb_snprintf(buf,
 									 sizeof(buf),
-									 "%02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x \n"
-									 "\n",
+									 "%02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x ",
 									 height[ 0], height[ 1], height[ 2], height[ 3], height[ 4], height[ 5], height[ 6], height[ 7],
 									 height[ 8], height[ 9], height[10], height[11], height[12], height[13], height[14], height[15]);
-						draw_y = DrawTextShadow(renderer, &fnt_cp437, buf, draw_x, draw_y).y;
+						draw_line("", buf, false);
+						draw_y += fnt_cp437.lineskip;
 					}
 				}
 
@@ -260,6 +497,12 @@ void Game::Draw(float delta) {
 		}
 	}
 
+	// without a window the software renderer already drew into framebuffer
+	if (readback && window) {
+		SDL_RenderReadPixels(renderer, nullptr, SDL_PIXELFORMAT_ARGB8888,
+							 framebuffer.surface->pixels, framebuffer.surface->pitch);
+	}
+
 	SDL_RenderPresent(renderer);
 
 	draw_took = (GetTime() - t) * 1000.0;
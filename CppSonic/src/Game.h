@@ -3,6 +3,11 @@
 // #define EDITOR
 
 #include "World.h"
+#include "SoftRenderer.h"
+#include "Replay.h"
+#include "RenderTest.h"
+#include "FrameCapture.h"
+#include "TextCache.h"
 
 #define GAME_W 424
 #define GAME_H 240
@@ -24,6 +29,48 @@ struct Game {
 	SDL_Window* window;
 	SDL_Renderer* renderer;
 	SDL_Texture* game_texture;
+
+	// With --offscreen there is no window. The game draws into framebuffer on
+	// the CPU as fast as it can for offscreen_frames frames, and saves the
+	// last one to screenshot_path.
+	// With --golden it draws through the renderer instead, the same way as on
+	// screen, HUD included, into a window that's never shown, and every frame
+	// is read back into framebuffer. Without video it falls back to SDL's
+	// software renderer drawing straight into framebuffer.
+	bool offscreen;
+	bool readback;
+	int offscreen_frames;
+	const char* screenshot_path;
+	SoftFramebuffer framebuffer;
+
+	// --replay plays the world's input back from a file, --record saves it
+	// on quit. Both together re-record a replay, so they use separate buffers.
+	// --render-tests runs a suite of replays against golden images, see
+	// RenderTest.h.
+	Replay replay;
+	Replay recording;
+	bool replay_playing;
+	const char* replay_path;
+	const char* record_path;
+	RenderTest render_test;
+	const char* render_test_suite;
+	int exit_code;
+
+	// --tile-layout row|blocked and --collision-layout interleaved|split pick
+	// how the tilemap and the collision profiles are stored. --bench-sensors
+	// plays a --replay offscreen, then times its sensor casts with each layout,
+	// see World::BenchmarkSensors.
+	TileMapLayout tile_layout;
+	TileCollisionLayout collision_layout;
+	bool bench_sensors;
+
+	// --capture <file> records from the start, F8 starts and stops recording
+	FrameCapture capture;
+	const char* capture_path;
+
+	// for the debug HUD
+	TextCache text_cache;
+
 	bool key_pressed[SDL_SCANCODE_UP + 1];
 	float mouse_x;
 	float mouse_y;
@@ -38,7 +85,9 @@ struct Game {
 	void Init();
 	void Quit();
 
+	void ParseArgs(int argc, char* argv[]);
 	void Run();
+	void RunOffscreen();
 	void Frame();
 	void Update(float delta);
 	void Draw(float delta);
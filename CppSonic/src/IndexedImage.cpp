@@ -0,0 +1,416 @@
+#include "IndexedImage.h"
+
+#include "misc.h"
+#include "mathh.h"
+
+#include <SDL_image.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define INDEXED_AVX2
+#ifdef _MSC_VER
+#define INDEXED_AVX2_FUNCTION
+#else
+#define INDEXED_AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+#endif
+
+typedef void (*ExpandFunc)(const uint8_t* src, const uint32_t* palette, uint32_t* dst, int n);
+
+static void expand_scalar(const uint8_t* src, const uint32_t* palette, uint32_t* dst, int n) {
+	for (int i = 0; i < n; i++) {
+		dst[i] = palette[src[i]];
+	}
+}
+
+#ifdef INDEXED_AVX2
+
+INDEXED_AVX2_FUNCTION
+static void expand_avx2(const uint8_t* src, const uint32_t* palette, uint32_t* dst, int n) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (src + i)));
+		__m256i colors = _mm256_i32gather_epi32((const int*) palette, indices, 4);
+		_mm256_storeu_si256((__m256i*) (dst + i), colors);
+	}
+
+	expand_scalar(src + i, palette, dst + i, n - i);
+}
+
+#endif
+
+static ExpandFunc expand = expand_scalar;
+
+static void pick_expand() {
+	expand = expand_scalar;
+#ifdef INDEXED_AVX2
+	if (SDL_HasAVX2()) {
+		expand = expand_avx2;
+	}
+#endif
+}
+
+enum {
+	BLOCK_DIRTY = 1, // pixels changed since the last update
+};
+
+static bool expand_dirty(IndexedImage* image);
+
+void GetIndexedRectColors(const IndexedImage* image, SDL_Rect rect, uint64_t colors[4]) {
+	colors[0] = colors[1] = colors[2] = colors[3] = 0;
+
+	if (!image->pixels) {
+		return;
+	}
+
+	int x0 = max(rect.x, 0);
+	int y0 = max(rect.y, 0);
+	int x1 = min(rect.x + rect.w, image->w);
+	int y1 = min(rect.y + rect.h, image->h);
+
+	for (int y = y0; y < y1; y++) {
+		for (int x = x0; x < x1; x++) {
+			int index = image->pixels[x + y * image->w];
+			colors[index / 64] |= uint64_t(1) << (index % 64);
+		}
+	}
+}
+
+static void update_block_colors(IndexedImage* image, int block_x, int block_y) {
+	SDL_Rect rect = {
+		block_x * image->block_size,
+		block_y * image->block_size,
+		image->block_size,
+		image->block_size
+	};
+	GetIndexedRectColors(image, rect, &image->block_colors[(block_x + block_y * image->blocks_x) * 4]);
+}
+
+static void mark_all_dirty(IndexedImage* image) {
+	for (int i = 0; i < 4; i++) {
+		image->dirty[i] = ~uint64_t(0);
+	}
+}
+
+// palette index of color, adding it if there's room
+static int find_color(IndexedImage* image, int* table, uint32_t color) {
+	uint32_t hash = color * 2654435761u;
+	int i = hash >> 23; // 512 slots
+	while (table[i] != -1) {
+		if (image->palette[table[i]] == color) {
+			return table[i];
+		}
+		i = (i + 1) & 511;
+	}
+
+	if (image->color_count == 256) {
+		return -1;
+	}
+
+	image->palette[image->color_count] = color;
+	table[i] = image->color_count;
+	return image->color_count++;
+}
+
+static bool read_pixels(IndexedImage* image, SDL_Surface* loaded) {
+	if (loaded->format->format == SDL_PIXELFORMAT_INDEX8 && loaded->format->palette) {
+		SDL_Palette* palette = loaded->format->palette;
+		image->color_count = min(palette->ncolors, 256);
+		for (int i = 0; i < image->color_count; i++) {
+			SDL_Color c = palette->colors[i];
+			image->palette[i] = (c.a << 24) | (c.r << 16) | (c.g << 8) | c.b;
+		}
+
+		// a single transparent entry comes as a color key
+		Uint32 key;
+		if (SDL_GetColorKey(loaded, &key) == 0 && key < 256) {
+			image->palette[key] &= 0x00FFFFFF;
+		}
+
+		for (int y = 0; y < image->h; y++) {
+			SDL_memcpy(&image->pixels[y * image->w], (uint8_t*) loaded->pixels + y * loaded->pitch, image->w);
+		}
+		return true;
+	}
+
+	SDL_Surface* argb = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+	if (!argb) {
+		return false;
+	}
+
+	int table[512];
+	for (int i = 0; i < 512; i++) {
+		table[i] = -1;
+	}
+
+	bool result = true;
+
+	for (int y = 0; y < image->h && result; y++) {
+		uint32_t* row = (uint32_t*) ((uint8_t*) argb->pixels + y * argb->pitch);
+		for (int x = 0; x < image->w; x++) {
+			uint32_t color = row[x];
+			if ((color >> 24) == 0) {
+				color = 0; // all invisible pixels are the same
+			}
+
+			int index = find_color(image, table, color);
+			if (index == -1) {
+				result = false;
+				break;
+			}
+
+			image->pixels[x + y * image->w] = (uint8_t) index;
+		}
+	}
+
+	SDL_FreeSurface(argb);
+	return result;
+}
+
+bool LoadIndexedImage(IndexedImage* image, const char* fname, SDL_Renderer* renderer, int block_size) {
+	*image = {};
+
+	pick_expand();
+
+	bool result = false;
+
+	SDL_Surface* loaded = IMG_Load(fname);
+
+	{
+		if (!loaded) {
+			goto out;
+		}
+
+		image->w = loaded->w;
+		image->h = loaded->h;
+		image->pixels = (uint8_t*) ecalloc(max(image->w * image->h, 1), 1);
+
+		if (!read_pixels(image, loaded)) {
+			goto out;
+		}
+
+		image->block_size = max(block_size, 1);
+		image->blocks_x = (image->w + image->block_size - 1) / image->block_size;
+		image->blocks_y = (image->h + image->block_size - 1) / image->block_size;
+		image->block_colors = (uint64_t*) ecalloc(max(image->blocks_x * image->blocks_y, 1), 4 * sizeof(uint64_t));
+		image->block_flags = (uint8_t*) ecalloc(max(image->blocks_x * image->blocks_y, 1), sizeof(uint8_t));
+
+		for (int block_y = 0; block_y < image->blocks_y; block_y++) {
+			for (int block_x = 0; block_x < image->blocks_x; block_x++) {
+				update_block_colors(image, block_x, block_y);
+			}
+		}
+
+		image->scratch = (uint32_t*) ecalloc(max(image->w, 1) * image->block_size, sizeof(uint32_t));
+
+		image->texture = SDL_CreateTexture(renderer,
+										   SDL_PIXELFORMAT_ARGB8888,
+										   SDL_TEXTUREACCESS_STREAMING,
+										   image->w, image->h);
+		if (!image->texture) {
+			goto out;
+		}
+		SDL_SetTextureBlendMode(image->texture, SDL_BLENDMODE_BLEND);
+
+		mark_all_dirty(image);
+		expand_dirty(image);
+
+		result = true;
+	}
+
+out:
+	if (loaded) SDL_FreeSurface(loaded);
+
+	if (!result) {
+		DestroyIndexedImage(image);
+	}
+
+	return result;
+}
+
+void DestroyIndexedImage(IndexedImage* image) {
+	if (image->texture) SDL_DestroyTexture(image->texture);
+	ReleaseIndexedPixels(image);
+
+	*image = {};
+}
+
+void ReleaseIndexedPixels(IndexedImage* image) {
+	if (image->scratch) free(image->scratch);
+	if (image->block_flags) free(image->block_flags);
+	if (image->block_colors) free(image->block_colors);
+	if (image->pixels) free(image->pixels);
+
+	image->scratch = nullptr;
+	image->block_flags = nullptr;
+	image->block_colors = nullptr;
+	image->pixels = nullptr;
+	image->cycle_count = 0;
+}
+
+void AttachIndexedSurface(IndexedImage* image, SDL_Surface* surface) {
+	image->surface = surface;
+
+	mark_all_dirty(image);
+	expand_dirty(image);
+}
+
+void SetPaletteColor(IndexedImage* image, int index, uint32_t color) {
+	if (index < 0 || index >= 256 || image->palette[index] == color) {
+		return;
+	}
+
+	image->palette[index] = color;
+	image->dirty[index / 64] |= uint64_t(1) << (index % 64);
+}
+
+void CopyIndexedRect(IndexedImage* image, SDL_Rect src, int x, int y) {
+	if (!image->pixels) {
+		return;
+	}
+
+	// clip against both rects
+	if (src.x < 0) {src.w += src.x; x -= src.x; src.x = 0;}
+	if (src.y < 0) {src.h += src.y; y -= src.y; src.y = 0;}
+	if (x < 0) {src.w += x; src.x -= x; x = 0;}
+	if (y < 0) {src.h += y; src.y -= y; y = 0;}
+	src.w = min(src.w, min(image->w - src.x, image->w - x));
+	src.h = min(src.h, min(image->h - src.y, image->h - y));
+
+	if (src.w <= 0 || src.h <= 0) {
+		return;
+	}
+
+	for (int row = 0; row < src.h; row++) {
+		SDL_memmove(&image->pixels[x + (y + row) * image->w],
+					&image->pixels[src.x + (src.y + row) * image->w],
+					src.w);
+	}
+
+	for (int block_y = y / image->block_size; block_y <= (y + src.h - 1) / image->block_size; block_y++) {
+		for (int block_x = x / image->block_size; block_x <= (x + src.w - 1) / image->block_size; block_x++) {
+			update_block_colors(image, block_x, block_y);
+			image->block_flags[block_x + block_y * image->blocks_x] |= BLOCK_DIRTY;
+		}
+	}
+}
+
+bool AddPaletteCycle(IndexedImage* image, const uint32_t* colors, int count, int frames_per_step) {
+	if (image->cycle_count == INDEXED_MAX_CYCLES || count < 2 || count > INDEXED_MAX_CYCLE_COLORS) {
+		return false;
+	}
+
+	PaletteCycle* cycle = &image->cycles[image->cycle_count];
+	*cycle = {};
+
+	for (int i = 0; i < count; i++) {
+		int index = -1;
+		for (int j = 0; j < image->color_count; j++) {
+			if (image->palette[j] == colors[i]) {
+				index = j;
+				break;
+			}
+		}
+
+		if (index == -1) {
+			return false;
+		}
+
+		cycle->indices[i] = (uint8_t) index;
+	}
+
+	cycle->count = count;
+	cycle->frames_per_step = max(frames_per_step, 1);
+	cycle->timer = cycle->frames_per_step;
+
+	image->cycle_count++;
+	return true;
+}
+
+// Expands the blocks with dirty pixels or palette entries, one texture update
+// per run of them in a row.
+static bool expand_dirty(IndexedImage* image) {
+	bool result = false;
+
+	for (int block_y = 0; block_y < image->blocks_y; block_y++) {
+		int first = -1;
+
+		for (int block_x = 0; block_x <= image->blocks_x; block_x++) {
+			bool dirty = false;
+			if (block_x < image->blocks_x) {
+				int block = block_x + block_y * image->blocks_x;
+				uint64_t* colors = &image->block_colors[block * 4];
+
+				dirty = ((image->block_flags[block] & BLOCK_DIRTY)
+						 || (colors[0] & image->dirty[0]) || (colors[1] & image->dirty[1])
+						 || (colors[2] & image->dirty[2]) || (colors[3] & image->dirty[3]));
+
+				image->block_flags[block] = 0;
+			}
+
+			if (dirty) {
+				if (first == -1) first = block_x;
+				continue;
+			}
+
+			if (first == -1) {
+				continue;
+			}
+
+			SDL_Rect rect;
+			rect.x = first * image->block_size;
+			rect.y = block_y * image->block_size;
+			rect.w = min(block_x * image->block_size, image->w) - rect.x;
+			rect.h = min(image->block_size, image->h - rect.y);
+			first = -1;
+
+			for (int y = 0; y < rect.h; y++) {
+				const uint8_t* src = &image->pixels[rect.x + (rect.y + y) * image->w];
+				expand(src, image->palette, &image->scratch[y * rect.w], rect.w);
+			}
+
+			SDL_UpdateTexture(image->texture, &rect, image->scratch, rect.w * sizeof(uint32_t));
+
+			if (image->surface) {
+				for (int y = 0; y < rect.h; y++) {
+					uint32_t* dest = (uint32_t*) ((uint8_t*) image->surface->pixels + (rect.y + y) * image->surface->pitch) + rect.x;
+					SDL_memcpy(dest, &image->scratch[y * rect.w], rect.w * sizeof(uint32_t));
+				}
+			}
+
+			result = true;
+		}
+	}
+
+	for (int i = 0; i < 4; i++) {
+		image->changed[i] = image->dirty[i];
+		image->dirty[i] = 0;
+	}
+
+	return result;
+}
+
+bool UpdateIndexedImage(IndexedImage* image) {
+	if (!image->pixels) {
+		return false;
+	}
+
+	for (int i = 0; i < image->cycle_count; i++) {
+		PaletteCycle* cycle = &image->cycles[i];
+		if (--cycle->timer > 0) {
+			continue;
+		}
+		cycle->timer = cycle->frames_per_step;
+
+		uint32_t last = image->palette[cycle->indices[cycle->count - 1]];
+		for (int j = cycle->count - 1; j > 0; j--) {
+			SetPaletteColor(image, cycle->indices[j], image->palette[cycle->indices[j - 1]]);
+		}
+		SetPaletteColor(image, cycle->indices[0], last);
+	}
+
+	return expand_dirty(image);
+}
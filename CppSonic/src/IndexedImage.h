@@ -0,0 +1,74 @@
+#pragma once
+
+#include <SDL.h>
+#include <stdint.h>
+
+// An 8-bit image and its palette, expanded into an ARGB8888 streaming texture.
+// When palette entries or pixels change, only the blocks they touch are
+// expanded and uploaded again, so palette effects and animated tiles cost
+// nothing at draw time. A tileset uses blocks the size of its slots.
+// The texture is still 32-bit, the 8-bit copy is kept on top of it, so it's
+// only worth it for images that change. ReleaseIndexedPixels drops it.
+#define INDEXED_BLOCK_SIZE 16
+#define INDEXED_MAX_CYCLES 8
+#define INDEXED_MAX_CYCLE_COLORS 16
+
+// Rotates a run of palette entries by one every frames_per_step frames.
+struct PaletteCycle {
+	uint8_t indices[INDEXED_MAX_CYCLE_COLORS];
+	int count;
+	int frames_per_step;
+	int timer;
+};
+
+struct IndexedImage {
+	uint8_t* pixels;
+	int w;
+	int h;
+
+	uint32_t palette[256]; // ARGB
+	int color_count;
+
+	// the palette entries every block uses, 256 bits each
+	uint64_t* block_colors;
+	uint8_t* block_flags;
+	int block_size;
+	int blocks_x;
+	int blocks_y;
+	uint64_t dirty[4];   // entries changed since the last update
+	uint64_t changed[4]; // entries the last update changed
+
+	PaletteCycle cycles[INDEXED_MAX_CYCLES];
+	int cycle_count;
+
+	uint32_t* scratch; // one row of blocks
+	SDL_Texture* texture;
+	SDL_Surface* surface; // if set, gets the same pixels as the texture
+};
+
+// Paletted PNGs keep their palette. Other images are converted if they have at
+// most 256 colors, returns false otherwise.
+bool LoadIndexedImage(IndexedImage* image, const char* fname, SDL_Renderer* renderer,
+					  int block_size = INDEXED_BLOCK_SIZE);
+void DestroyIndexedImage(IndexedImage* image);
+
+// Frees everything but the texture, once nothing is going to change the image.
+void ReleaseIndexedPixels(IndexedImage* image);
+
+// Expands into surface (ARGB8888, the image's size) as well from now on.
+void AttachIndexedSurface(IndexedImage* image, SDL_Surface* surface);
+
+void SetPaletteColor(IndexedImage* image, int index, uint32_t color);
+
+// Copies a rect of pixels within the image. Expanded on the next update.
+void CopyIndexedRect(IndexedImage* image, SDL_Rect src, int x, int y);
+
+// The colors are looked up in the palette. Returns false if one isn't there.
+bool AddPaletteCycle(IndexedImage* image, const uint32_t* colors, int count, int frames_per_step);
+
+// Advances the cycles by a frame and expands what changed. Returns true if
+// anything did.
+bool UpdateIndexedImage(IndexedImage* image);
+
+// The palette entries the pixels in rect use, 256 bits.
+void GetIndexedRectColors(const IndexedImage* image, SDL_Rect rect, uint64_t colors[4]);
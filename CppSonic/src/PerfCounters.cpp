@@ -0,0 +1,106 @@
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h> // for strerror
+
+static int open_counter(uint32_t type, uint64_t config) {
+	perf_event_attr attr = {};
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	// this thread, any cpu
+	return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+bool OpenPerfCounters(PerfCounters* counters) {
+	*counters = {};
+
+	uint64_t l1d_read_miss = (PERF_COUNT_HW_CACHE_L1D
+							  | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+							  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+
+	counters->fds[PERF_L1D_MISSES] = open_counter(PERF_TYPE_HW_CACHE, l1d_read_miss);
+	counters->fds[PERF_LLC_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+		if (counters->fds[i] == -1) {
+			SDL_SetError("perf_event_open failed: %s (no hardware counters, or perf_event_paranoid forbids them)", strerror(errno));
+			for (int j = 0; j < PERF_COUNTER_COUNT; j++) {
+				if (counters->fds[j] != -1) close(counters->fds[j]);
+			}
+			*counters = {};
+			return false;
+		}
+	}
+
+	counters->open = true;
+	return true;
+}
+
+void ClosePerfCounters(PerfCounters* counters) {
+	if (counters->open) {
+		for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+			close(counters->fds[i]);
+		}
+	}
+	*counters = {};
+}
+
+void StartPerfCounters(PerfCounters* counters) {
+	if (!counters->open) {
+		return;
+	}
+
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+		ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+void StopPerfCounters(PerfCounters* counters, uint64_t values[PERF_COUNTER_COUNT]) {
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+		values[i] = 0;
+	}
+
+	if (!counters->open) {
+		return;
+	}
+
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+		ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(counters->fds[i], &values[i], sizeof(values[i])) != sizeof(values[i])) {
+			values[i] = 0;
+		}
+	}
+}
+
+#else
+
+bool OpenPerfCounters(PerfCounters* counters) {
+	*counters = {};
+	SDL_SetError("cache miss counters are only read through Linux perf events, there's no user mode API for them on this platform");
+	return false;
+}
+
+void ClosePerfCounters(PerfCounters* counters) {
+	*counters = {};
+}
+
+void StartPerfCounters(PerfCounters* counters) {}
+
+void StopPerfCounters(PerfCounters* counters, uint64_t values[PERF_COUNTER_COUNT]) {
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+		values[i] = 0;
+	}
+}
+
+#endif
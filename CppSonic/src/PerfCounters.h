@@ -0,0 +1,25 @@
+#pragma once
+
+#include <SDL.h>
+#include <stdint.h>
+
+enum {
+	PERF_L1D_MISSES, // L1 data cache read misses
+	PERF_LLC_MISSES, // last level cache misses
+	PERF_COUNTER_COUNT
+};
+
+// Hardware cache miss counters for the calling thread, counting user mode
+// only. They are read through perf events, so they only exist on Linux, and
+// only if perf_event_paranoid allows it; Windows has no user mode API for
+// them. Everywhere else OpenPerfCounters fails and SDL_GetError says why.
+struct PerfCounters {
+	int fds[PERF_COUNTER_COUNT];
+	bool open;
+};
+
+bool OpenPerfCounters(PerfCounters* counters);
+void ClosePerfCounters(PerfCounters* counters);
+
+void StartPerfCounters(PerfCounters* counters);
+void StopPerfCounters(PerfCounters* counters, uint64_t values[PERF_COUNTER_COUNT]);
@@ -0,0 +1,320 @@
+#include "PlaneRenderer.h"
+
+#include "Game.h"
+
+#include "misc.h"
+#include "mathh.h"
+
+static int floor_div(int a, int b) {
+	return (a >= 0) ? (a / b) : -((-a + b - 1) / b);
+}
+
+static int wrap(int a, int b) {
+	int result = a % b;
+	if (result < 0) {
+		result += b;
+	}
+	return result;
+}
+
+void PlaneRenderer::Init() {
+	batch.Init();
+}
+
+void PlaneRenderer::Destroy() {
+	for (int i = 0; i < TILEMAP_MAX_LAYERS * 2; i++) {
+		if (planes[i].texture) SDL_DestroyTexture(planes[i].texture);
+		if (planes[i].dirty) free(planes[i].dirty);
+		planes[i] = {};
+	}
+
+	batch.Destroy();
+}
+
+void PlaneRenderer::Clear() {
+	for (int i = 0; i < TILEMAP_MAX_LAYERS * 2; i++) {
+		planes[i].valid = false;
+		planes[i].dirty_count = 0;
+	}
+}
+
+void PlaneRenderer::InvalidateTile(int tile_x, int tile_y, int layer) {
+	// the tile may have changed priority, so both planes
+	for (int priority = 0; priority < 2; priority++) {
+		TilePlane* plane = &planes[layer * 2 + priority];
+		if (!plane->valid) {
+			continue;
+		}
+
+		if (plane->tile_x <= tile_x && tile_x < plane->tile_x + plane->columns
+			&& plane->tile_y <= tile_y && tile_y < plane->tile_y + plane->rows) {
+			if (plane->dirty_count < plane->columns * plane->rows) {
+				plane->dirty[plane->dirty_count++] = {tile_x, tile_y};
+			} else {
+				// more changes than slots, redrawing everything is as cheap
+				plane->valid = false;
+				plane->dirty_count = 0;
+			}
+		}
+	}
+}
+
+static void add_tile(TilePlane* plane, Tile tile, int x, int y, TileSet* tileset, TileBatch* batch) {
+	SDL_Rect dest = {
+		wrap(x, plane->columns) * 16,
+		wrap(y, plane->rows) * 16,
+		16,
+		16
+	};
+
+	SDL_Rect src = tileset->GetTextureSrcRect(tile.index);
+
+	int flip = SDL_FLIP_NONE;
+	if (tile.hflip) flip |= SDL_FLIP_HORIZONTAL;
+	if (tile.vflip) flip |= SDL_FLIP_VERTICAL;
+	batch->Add(src, dest, flip);
+}
+
+// Draws tiles [x0, x1) x [y0, y1) of one priority into their slots. The slots
+// are cleared first, with at most four rects since they wrap around.
+static int draw_tiles(TilePlane* plane, int layer, bool priority, TileMap* tilemap, TileSet* tileset, TileBatch* batch,
+					  int x0, int y0, int x1, int y1) {
+	int drawn = 0;
+
+	{
+		int slot_x = wrap(x0, plane->columns);
+		int slot_y = wrap(y0, plane->rows);
+		int w = x1 - x0;
+		int h = y1 - y0;
+		int w1 = min(w, plane->columns - slot_x);
+		int h1 = min(h, plane->rows - slot_y);
+
+		SDL_Rect rects[4];
+		int rect_count = 0;
+		rects[rect_count++] = {slot_x * 16, slot_y * 16, w1 * 16, h1 * 16};
+		if (w > w1)            rects[rect_count++] = {0, slot_y * 16, (w - w1) * 16, h1 * 16};
+		if (h > h1)            rects[rect_count++] = {slot_x * 16, 0, w1 * 16, (h - h1) * 16};
+		if (w > w1 && h > h1)  rects[rect_count++] = {0, 0, (w - w1) * 16, (h - h1) * 16};
+
+		SDL_RenderFillRects(game->renderer, rects, rect_count);
+	}
+
+	batch->Begin(tileset->texture);
+
+	for (int y = max(y0, 0); y < min(y1, tilemap->height); y++) {
+		for (int x = max(x0, 0); x < min(x1, tilemap->width); x++) {
+			Tile tile = tilemap->GetTileGraphicUnchecked(x, y, layer);
+			if (tile.priority != priority) {
+				continue;
+			}
+
+			add_tile(plane, tile, x, y, tileset, batch);
+			drawn++;
+		}
+	}
+
+	batch->Flush();
+
+	return drawn;
+}
+
+// Draws the tiles in the dirty list again, after the plane has moved to where
+// it is this frame.
+static int draw_dirty_tiles(TilePlane* plane, int layer, bool priority, TileMap* tilemap, TileSet* tileset, TileBatch* batch) {
+	int drawn = 0;
+
+	auto in_plane = [plane](SDL_Point p) {
+		return (plane->tile_x <= p.x && p.x < plane->tile_x + plane->columns
+				&& plane->tile_y <= p.y && p.y < plane->tile_y + plane->rows);
+	};
+
+	// the ones that scrolled out have another tile in their slot by now
+	for (int i = 0; i < plane->dirty_count; i++) {
+		SDL_Point p = plane->dirty[i];
+		if (!in_plane(p)) {
+			continue;
+		}
+
+		SDL_Rect rect = {wrap(p.x, plane->columns) * 16, wrap(p.y, plane->rows) * 16, 16, 16};
+		SDL_RenderFillRect(game->renderer, &rect);
+	}
+
+	batch->Begin(tileset->texture);
+
+	for (int i = 0; i < plane->dirty_count; i++) {
+		SDL_Point p = plane->dirty[i];
+		if (!in_plane(p) || p.x < 0 || p.x >= tilemap->width || p.y < 0 || p.y >= tilemap->height) {
+			continue;
+		}
+
+		Tile tile = tilemap->GetTileGraphicUnchecked(p.x, p.y, layer);
+		if (tile.priority != priority) {
+			continue;
+		}
+
+		add_tile(plane, tile, p.x, p.y, tileset, batch);
+		drawn++;
+	}
+
+	batch->Flush();
+
+	plane->dirty_count = 0;
+
+	return drawn;
+}
+
+bool PlaneRenderer::Update(TileMap* tilemap, TileSet* tileset, float view_x, float view_y, int view_w, int view_h) {
+	tiles_drawn_last_frame = 0;
+
+	if (!tileset->texture || !SDL_RenderTargetSupported(game->renderer)) {
+		return false;
+	}
+
+	// one more tile than the view so partly visible tiles at both ends fit
+	int columns = (view_w + 15) / 16 + 1;
+	int rows    = (view_h + 15) / 16 + 1;
+
+	int tile_x = floor_div(int(view_x), 16);
+	int tile_y = floor_div(int(view_y), 16);
+
+	bool result = true;
+
+	SDL_Texture* old_target = nullptr;
+	float scale_x = 1.0f;
+	float scale_y = 1.0f;
+	Uint8 r, g, b, a;
+	SDL_BlendMode blend_mode = SDL_BLENDMODE_BLEND;
+	SDL_BlendMode draw_blend_mode = SDL_BLENDMODE_BLEND;
+	bool switched_target = false;
+
+	for (int i = 0; i < tilemap->layer_count * 2; i++) {
+		int layer = i / 2;
+		bool priority = i % 2;
+
+		if (!(tilemap->layer_flags[layer] & (TILE_LAYER_BACKGROUND | TILE_LAYER_FOREGROUND))) {
+			continue;
+		}
+
+		TilePlane* plane = &planes[i];
+
+		if (plane->columns != columns || plane->rows != rows || !plane->texture) {
+			if (plane->texture) SDL_DestroyTexture(plane->texture);
+			if (plane->dirty) free(plane->dirty);
+			*plane = {};
+
+			plane->texture = SDL_CreateTexture(game->renderer,
+											   SDL_PIXELFORMAT_ARGB8888,
+											   SDL_TEXTUREACCESS_TARGET,
+											   columns * 16, rows * 16);
+			if (!plane->texture) {
+				result = false;
+				continue;
+			}
+			SDL_SetTextureBlendMode(plane->texture, SDL_BLENDMODE_BLEND);
+
+			plane->columns = columns;
+			plane->rows = rows;
+			plane->dirty = (SDL_Point*) ecalloc(columns * rows, sizeof(*plane->dirty));
+		}
+
+		int dx = tile_x - plane->tile_x;
+		int dy = tile_y - plane->tile_y;
+
+		if (plane->valid && dx == 0 && dy == 0 && plane->dirty_count == 0) {
+			continue;
+		}
+
+		if (!switched_target) {
+			// switching targets resets the scale, and the editor draws zoomed
+			old_target = SDL_GetRenderTarget(game->renderer);
+			SDL_RenderGetScale(game->renderer, &scale_x, &scale_y);
+			SDL_GetRenderDrawColor(game->renderer, &r, &g, &b, &a);
+			SDL_GetRenderDrawBlendMode(game->renderer, &draw_blend_mode);
+
+			// tiles overwrite their slot, alpha included
+			SDL_GetTextureBlendMode(tileset->texture, &blend_mode);
+			SDL_SetTextureBlendMode(tileset->texture, SDL_BLENDMODE_NONE);
+			SDL_SetRenderDrawBlendMode(game->renderer, SDL_BLENDMODE_NONE);
+			SDL_SetRenderDrawColor(game->renderer, 0, 0, 0, 0);
+
+			switched_target = true;
+		}
+
+		SDL_SetRenderTarget(game->renderer, plane->texture);
+
+		int x0 = tile_x;
+		int y0 = tile_y;
+		int x1 = tile_x + columns;
+		int y1 = tile_y + rows;
+
+		if (!plane->valid || abs(dx) >= columns || abs(dy) >= rows) {
+			tiles_drawn_last_frame += draw_tiles(plane, layer, priority, tilemap, tileset, &batch, x0, y0, x1, y1);
+			plane->dirty_count = 0;
+		} else {
+			// the columns and rows that came into view
+			if (dx > 0) tiles_drawn_last_frame += draw_tiles(plane, layer, priority, tilemap, tileset, &batch, x1 - dx, y0, x1, y1);
+			if (dx < 0) tiles_drawn_last_frame += draw_tiles(plane, layer, priority, tilemap, tileset, &batch, x0, y0, x0 - dx, y1);
+			if (dy > 0) tiles_drawn_last_frame += draw_tiles(plane, layer, priority, tilemap, tileset, &batch, x0, y1 - dy, x1, y1);
+			if (dy < 0) tiles_drawn_last_frame += draw_tiles(plane, layer, priority, tilemap, tileset, &batch, x0, y0, x1, y0 - dy);
+		}
+
+		plane->tile_x = tile_x;
+		plane->tile_y = tile_y;
+		plane->valid = true;
+
+		if (plane->dirty_count > 0) {
+			tiles_drawn_last_frame += draw_dirty_tiles(plane, layer, priority, tilemap, tileset, &batch);
+		}
+	}
+
+	if (switched_target) {
+		SDL_SetTextureBlendMode(tileset->texture, blend_mode);
+		SDL_SetRenderTarget(game->renderer, old_target);
+		SDL_RenderSetScale(game->renderer, scale_x, scale_y);
+		SDL_SetRenderDrawBlendMode(game->renderer, draw_blend_mode);
+		SDL_SetRenderDrawColor(game->renderer, r, g, b, a);
+	}
+
+	return result;
+}
+
+bool PlaneRenderer::Draw(int layer, bool priority, float view_x, float view_y) {
+	TilePlane* plane = &planes[layer * 2 + priority];
+	if (!plane->valid) {
+		return false;
+	}
+
+	int w = plane->columns * 16;
+	int h = plane->rows * 16;
+
+	// where the top left tile is in the texture
+	int split_x = wrap(plane->tile_x, plane->columns) * 16;
+	int split_y = wrap(plane->tile_y, plane->rows) * 16;
+
+	int screen_x = plane->tile_x * 16 - int(view_x);
+	int screen_y = plane->tile_y * 16 - int(view_y);
+
+	SDL_Rect pieces[4] = {
+		{split_x, split_y, w - split_x, h - split_y},
+		{0,       split_y, split_x,     h - split_y},
+		{split_x, 0,       w - split_x, split_y},
+		{0,       0,       split_x,     split_y},
+	};
+
+	for (int i = 0; i < 4; i++) {
+		SDL_Rect src = pieces[i];
+		if (src.w == 0 || src.h == 0) {
+			continue;
+		}
+
+		SDL_Rect dest = {
+			screen_x + ((i % 2 == 1) ? (w - split_x) : 0),
+			screen_y + ((i / 2 == 1) ? (h - split_y) : 0),
+			src.w,
+			src.h
+		};
+		SDL_RenderCopy(game->renderer, plane->texture, &src, &dest);
+	}
+
+	return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "TileSet.h"
+#include "TileMap.h"
+#include "TileBatch.h"
+
+// Keeps the tiles around the view of one layer in a texture a tile larger
+// than the view, like a Mega Drive plane. Tile (x, y) always sits at
+// (x mod columns, y mod rows), so when the camera moves only the rows and
+// columns that came into view are drawn, and the texture is shown as up to
+// four wrapped pieces. Every layer has a low and a high priority plane, so
+// the sprites can go between them.
+struct TilePlane {
+	SDL_Texture* texture;
+	int columns;
+	int rows;
+
+	// the tiles in the texture
+	int tile_x;
+	int tile_y;
+	bool valid;
+
+	// tiles that changed since they were drawn, there's room for every slot
+	SDL_Point* dirty;
+	int dirty_count;
+};
+
+struct PlaneRenderer {
+	TilePlane planes[TILEMAP_MAX_LAYERS * 2]; // layer * 2 + priority
+	TileBatch batch;
+
+	int tiles_drawn_last_frame;
+
+	void Init();
+	void Destroy();
+
+	// Redraw everything on the next update.
+	void Clear();
+
+	// Redraw just this tile on the next update.
+	void InvalidateTile(int tile_x, int tile_y, int layer);
+
+	// Call once per frame before drawing. Returns false if a plane couldn't be
+	// made, its layer has to be drawn some other way then.
+	bool Update(TileMap* tilemap, TileSet* tileset, float view_x, float view_y, int view_w, int view_h);
+
+	// Returns false if the layer has no plane.
+	bool Draw(int layer, bool priority, float view_x, float view_y);
+};
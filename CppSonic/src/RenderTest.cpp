@@ -0,0 +1,238 @@
+#include "RenderTest.h"
+
+#include "SoftRenderer.h"
+#include "misc.h"
+#include "mathh.h"
+
+#include <SDL_image.h>
+
+void ParseRenderTestFrames(RenderTest* test, const char* list) {
+	test->frame_count = 0;
+
+	const char* it = list;
+	while (*it && test->frame_count < RENDER_TEST_MAX_FRAMES) {
+		int frame = SDL_atoi(it);
+		if (frame > 0) {
+			test->frames[test->frame_count++] = frame;
+		}
+
+		while (*it && *it != ',') it++;
+		if (*it == ',') it++;
+	}
+}
+
+int GetRenderTestLastFrame(const RenderTest* test) {
+	int result = 0;
+	for (int i = 0; i < test->frame_count; i++) {
+		result = max(result, test->frames[i]);
+	}
+	return result;
+}
+
+static bool compare_with_golden(RenderTest* test, SDL_Surface* frame, int frame_index) {
+	char fname[512];
+	stb_snprintf(fname, sizeof(fname), "%s_%d.png", test->golden_prefix, frame_index);
+
+	if (test->update) {
+		if (IMG_SavePNG(frame, fname) != 0) {
+			SDL_Log("%s: couldn't save: %s", fname, SDL_GetError());
+			return false;
+		}
+		SDL_Log("%s: updated", fname);
+		return true;
+	}
+
+	SDL_Surface* golden = LoadSoftSurface(fname);
+	if (!golden) {
+		SDL_Log("%s: couldn't load golden image", fname);
+		return false;
+	}
+
+	int differing = 0;
+	int max_diff = 0;
+
+	if (golden->w != frame->w || golden->h != frame->h) {
+		differing = frame->w * frame->h;
+		max_diff = 255;
+	} else {
+		for (int y = 0; y < frame->h; y++) {
+			uint32_t* a = (uint32_t*) ((uint8_t*) frame->pixels  + y * frame->pitch);
+			uint32_t* b = (uint32_t*) ((uint8_t*) golden->pixels + y * golden->pitch);
+
+			for (int x = 0; x < frame->w; x++) {
+				// alpha of the framebuffer isn't shown, so it doesn't count
+				if ((a[x] & 0xFFFFFF) == (b[x] & 0xFFFFFF)) {
+					continue;
+				}
+
+				differing++;
+				for (int shift = 0; shift < 24; shift += 8) {
+					int diff = abs(int((a[x] >> shift) & 0xFF) - int((b[x] >> shift) & 0xFF));
+					max_diff = max(max_diff, diff);
+				}
+			}
+		}
+	}
+
+	SDL_FreeSurface(golden);
+
+	if (differing > 0) {
+		SDL_Log("%s: %d pixels differ (%.3f%%), max channel difference %d",
+				fname, differing, 100.0 * double(differing) / double(frame->w * frame->h), max_diff);
+
+		char actual_fname[512];
+		stb_snprintf(actual_fname, sizeof(actual_fname), "%s_%d_actual.png", test->golden_prefix, frame_index);
+		IMG_SavePNG(frame, actual_fname);
+		return false;
+	}
+
+	return true;
+}
+
+void CheckRenderTestFrame(RenderTest* test, SDL_Surface* frame, int frame_index, double draw_took) {
+	test->frames_drawn++;
+	test->draw_time_total += draw_took;
+	test->draw_time_max = max(test->draw_time_max, draw_took);
+
+	for (int i = 0; i < test->frame_count; i++) {
+		if (test->frames[i] == frame_index) {
+			if (!compare_with_golden(test, frame, frame_index)) {
+				test->failures++;
+			}
+			break;
+		}
+	}
+}
+
+void ReportRenderTest(const RenderTest* test) {
+	double average = test->draw_time_total / double(max(test->frames_drawn, 1));
+	SDL_Log("%s: %s, %d of %d frames differ, draw %fms average, %fms max",
+			test->golden_prefix,
+			(test->failures == 0) ? "ok" : "FAILED",
+			test->failures, test->frame_count,
+			average, test->draw_time_max);
+}
+
+struct SceneJob {
+	char name[64];
+	char command[1024];
+	int exit_code;
+	double took;
+};
+
+struct SuiteRun {
+	SceneJob* jobs;
+	int job_count;
+	SDL_atomic_t next_job;
+};
+
+static int run_scenes_job(void* userdata) {
+	SuiteRun* run = (SuiteRun*) userdata;
+
+	while (true) {
+		int i = SDL_AtomicAdd(&run->next_job, 1);
+		if (i >= run->job_count) {
+			break;
+		}
+
+		SceneJob* job = &run->jobs[i];
+
+		double t = GetTime();
+		job->exit_code = system(job->command);
+		job->took = GetTime() - t;
+	}
+
+	return 0;
+}
+
+int RunRenderTestSuite(const char* exe, const char* suite_fname, bool update) {
+	size_t size;
+	char* text = (char*) SDL_LoadFile(suite_fname, &size);
+	if (!text) {
+		SDL_Log("Couldn't read %s.", suite_fname);
+		return 1;
+	}
+
+	// goldens live next to the suite file
+	char dir[512] = {};
+	{
+		const char* slash = nullptr;
+		for (const char* it = suite_fname; *it; it++) {
+			if (*it == '/' || *it == '\\') slash = it;
+		}
+		if (slash) {
+			stb_snprintf(dir, sizeof(dir), "%.*s", int(slash - suite_fname + 1), suite_fname);
+		}
+	}
+
+	SuiteRun run = {};
+	run.jobs = (SceneJob*) ecalloc(RENDER_TEST_MAX_SCENES, sizeof(*run.jobs));
+
+	for (char* line = text; line && *line;) {
+		char* end = line;
+		while (*end && *end != '\n') end++;
+		char* next = *end ? end + 1 : nullptr;
+		*end = 0;
+
+		char name[64];
+		char replay[256];
+		char frames[256];
+		if (line[0] != '#' && SDL_sscanf(line, "%63s %255s %255s", name, replay, frames) == 3) {
+			if (run.job_count == RENDER_TEST_MAX_SCENES) {
+				SDL_Log("Too many scenes, only the first %d are run.", RENDER_TEST_MAX_SCENES);
+				break;
+			}
+
+			SceneJob* job = &run.jobs[run.job_count++];
+			stb_snprintf(job->name, sizeof(job->name), "%s", name);
+
+			char command[1024];
+			stb_snprintf(command, sizeof(command),
+						 "\"%s\" --offscreen --replay \"%s%s\" --golden \"%s%s\" --golden-frames %s%s",
+						 exe, dir, replay, dir, name, frames, update ? " --update-golden" : "");
+
+#ifdef _WIN32
+			// system() runs cmd /c, which strips the first and last quote of a
+			// command that starts with one, so the whole thing is quoted again
+			stb_snprintf(job->command, sizeof(job->command), "\"%s\"", command);
+#else
+			stb_snprintf(job->command, sizeof(job->command), "%s", command);
+#endif
+		}
+
+		line = next;
+	}
+
+	SDL_free(text);
+
+	double t = GetTime();
+
+	int thread_count = clamp(SDL_GetCPUCount(), 1, max(run.job_count, 1));
+	SDL_Thread** threads = (SDL_Thread**) ecalloc(thread_count, sizeof(*threads));
+
+	for (int i = 1; i < thread_count; i++) {
+		threads[i] = SDL_CreateThread(run_scenes_job, "render test", &run);
+	}
+
+	run_scenes_job(&run);
+
+	for (int i = 1; i < thread_count; i++) {
+		if (threads[i]) SDL_WaitThread(threads[i], nullptr);
+	}
+
+	free(threads);
+
+	int failed = 0;
+	for (int i = 0; i < run.job_count; i++) {
+		SceneJob* job = &run.jobs[i];
+		if (job->exit_code != 0) failed++;
+		SDL_Log("%-24s %s %fs", job->name, (job->exit_code == 0) ? "ok    " : "FAILED", job->took);
+	}
+
+	SDL_Log("%d of %d scenes passed in %fs on %d threads.",
+			run.job_count - failed, run.job_count, GetTime() - t, thread_count);
+
+	free(run.jobs);
+
+	return (failed == 0) ? 0 : 1;
+}
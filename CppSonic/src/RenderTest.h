@@ -0,0 +1,34 @@
+#pragma once
+
+#include <SDL.h>
+
+#define RENDER_TEST_MAX_FRAMES 64
+#define RENDER_TEST_MAX_SCENES 256
+
+// One scene of the render regression suite. The game plays a replay
+// offscreen, and the listed frames are compared with golden PNGs named
+// <golden_prefix>_<frame>.png.
+struct RenderTest {
+	const char* golden_prefix; // nullptr if not testing
+	int frames[RENDER_TEST_MAX_FRAMES];
+	int frame_count;
+	bool update; // write the goldens instead of comparing
+
+	int failures;
+	int frames_drawn;
+	double draw_time_total; // ms
+	double draw_time_max;
+};
+
+// Takes a comma separated list, like "60,120,300".
+void ParseRenderTestFrames(RenderTest* test, const char* list);
+int GetRenderTestLastFrame(const RenderTest* test);
+
+void CheckRenderTestFrame(RenderTest* test, SDL_Surface* frame, int frame_index, double draw_took);
+void ReportRenderTest(const RenderTest* test);
+
+// Runs every scene of a suite file as its own offscreen process of exe, as
+// many at a time as there are cores. Each line of the file is
+//   <name> <replay file> <frame>,<frame>,...
+// and the goldens are next to the suite file. Returns the exit code.
+int RunRenderTestSuite(const char* exe, const char* suite_fname, bool update);
@@ -0,0 +1,94 @@
+#include "Replay.h"
+
+#include "misc.h"
+#include "mathh.h"
+
+bool LoadReplay(Replay* replay, const char* fname) {
+	DestroyReplay(replay);
+
+	bool result = false;
+
+	SDL_RWops* f = SDL_RWFromFile(fname, "rb");
+
+	{
+		if (!f) {
+			goto out;
+		}
+
+		int magic = 0;
+		SDL_RWread(f, &magic, sizeof(magic), 1);
+		if (magic != REPLAY_MAGIC) {
+			goto out;
+		}
+
+		int frame_count = 0;
+		SDL_RWread(f, &frame_count, sizeof(frame_count), 1);
+		if (frame_count < 0) {
+			goto out;
+		}
+
+		replay->inputs = (uint32_t*) ecalloc(max(frame_count, 1), sizeof(*replay->inputs));
+		replay->capacity = max(frame_count, 1);
+		replay->frame_count = frame_count;
+
+		if (SDL_RWread(f, replay->inputs, sizeof(*replay->inputs), frame_count) != (size_t) frame_count) {
+			goto out;
+		}
+
+		result = true;
+	}
+
+out:
+	if (f) SDL_RWclose(f);
+
+	if (!result) {
+		DestroyReplay(replay);
+	}
+
+	return result;
+}
+
+bool SaveReplay(const Replay* replay, const char* fname) {
+	SDL_RWops* f = SDL_RWFromFile(fname, "wb");
+	if (!f) {
+		return false;
+	}
+
+	int magic = REPLAY_MAGIC;
+	bool ok = (SDL_RWwrite(f, &magic, sizeof(magic), 1) == 1
+			   && SDL_RWwrite(f, &replay->frame_count, sizeof(replay->frame_count), 1) == 1
+			   && SDL_RWwrite(f, replay->inputs, sizeof(*replay->inputs), replay->frame_count) == (size_t) replay->frame_count);
+
+	SDL_RWclose(f);
+	return ok;
+}
+
+void DestroyReplay(Replay* replay) {
+	if (replay->inputs) free(replay->inputs);
+	*replay = {};
+}
+
+void RecordReplayFrame(Replay* replay, uint32_t input) {
+	if (replay->frame_count == replay->capacity) {
+		int capacity = max(replay->capacity * 2, 1024);
+		uint32_t* inputs = (uint32_t*) ecalloc(capacity, sizeof(*inputs));
+		if (replay->inputs) {
+			SDL_memcpy(inputs, replay->inputs, replay->frame_count * sizeof(*inputs));
+			free(replay->inputs);
+		}
+		replay->inputs = inputs;
+		replay->capacity = capacity;
+	}
+
+	replay->inputs[replay->frame_count++] = input;
+}
+
+bool PlayReplayFrame(Replay* replay, uint32_t* input) {
+	if (replay->position >= replay->frame_count) {
+		*input = 0;
+		return false;
+	}
+
+	*input = replay->inputs[replay->position++];
+	return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <SDL.h>
+#include <stdint.h>
+
+#define REPLAY_MAGIC int(0xC5525059)
+
+// The player's input bits for every frame, so a run can be played back exactly.
+struct Replay {
+	uint32_t* inputs;
+	int frame_count;
+	int capacity;
+	int position; // next frame to play
+};
+
+bool LoadReplay(Replay* replay, const char* fname);
+bool SaveReplay(const Replay* replay, const char* fname);
+void DestroyReplay(Replay* replay);
+
+void RecordReplayFrame(Replay* replay, uint32_t input);
+
+// Returns false once the replay has run out.
+bool PlayReplayFrame(Replay* replay, uint32_t* input);
@@ -0,0 +1,354 @@
+#include "SoftRenderer.h"
+
+#include "misc.h"
+#include "mathh.h"
+
+#include <SDL_image.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define SOFT_SSE2
+#endif
+
+#if defined(SOFT_SSE2) && (defined(__x86_64__) || defined(_M_X64))
+#define SOFT_AVX2
+#ifdef _MSC_VER
+#define SOFT_AVX2_FUNCTION
+#else
+#define SOFT_AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+#endif
+
+// widest source row a blit can take
+#define SOFT_MAX_SPAN 1024
+
+static SDL_Renderer* bound_renderer;
+static SoftFramebuffer* bound_framebuffer;
+
+// dst = src over dst, for n pixels
+typedef void (*BlendSpanFunc)(uint32_t* dst, const uint32_t* src, int n);
+
+static void blend_span_scalar(uint32_t* dst, const uint32_t* src, int n) {
+	for (int i = 0; i < n; i++) {
+		uint32_t s = src[i];
+		uint32_t a = s >> 24;
+
+		if (a == 255) {
+			dst[i] = s;
+		} else if (a != 0) {
+			uint32_t d = dst[i];
+			uint32_t result = 0;
+
+			for (int shift = 0; shift < 32; shift += 8) {
+				uint32_t sc = (shift == 24) ? 255 : ((s >> shift) & 0xFF);
+				uint32_t dc = (d >> shift) & 0xFF;
+				uint32_t t = sc * a + dc * (255 - a);
+				t = (t + 1 + (t >> 8)) >> 8; // t / 255
+				result |= t << shift;
+			}
+
+			dst[i] = result;
+		}
+	}
+}
+
+#ifdef SOFT_SSE2
+
+// Blends 2 pixels unpacked to 16 bits per channel. The source alpha channel
+// is replaced with 255, so the result alpha is a + d * (255 - a) / 255.
+static inline __m128i blend_unpacked_sse2(__m128i s, __m128i d) {
+	__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+	__m128i inv_a = _mm_sub_epi16(_mm_set1_epi16(255), a);
+
+	s = _mm_or_si128(s, _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0));
+
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, inv_a));
+	t = _mm_add_epi16(t, _mm_add_epi16(_mm_set1_epi16(1), _mm_srli_epi16(t, 8)));
+	return _mm_srli_epi16(t, 8);
+}
+
+static void blend_span_sse2(uint32_t* dst, const uint32_t* src, int n) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i opaque = _mm_set1_epi32(0xFF000000);
+
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+		__m128i alpha = _mm_and_si128(s, opaque);
+
+		int all_opaque = _mm_movemask_epi8(_mm_cmpeq_epi32(alpha, opaque));
+		if (all_opaque == 0xFFFF) {
+			_mm_storeu_si128((__m128i*) (dst + i), s);
+			continue;
+		}
+
+		int all_clear = _mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero));
+		if (all_clear == 0xFFFF) {
+			continue;
+		}
+
+		__m128i d = _mm_loadu_si128((const __m128i*) (dst + i));
+
+		__m128i lo = blend_unpacked_sse2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+		__m128i hi = blend_unpacked_sse2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+
+		_mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(lo, hi));
+	}
+
+	blend_span_scalar(dst + i, src + i, n - i);
+}
+
+#endif
+
+#ifdef SOFT_AVX2
+
+SOFT_AVX2_FUNCTION
+static inline __m256i blend_unpacked_avx2(__m256i s, __m256i d) {
+	__m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xFF), 0xFF);
+	__m256i inv_a = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+
+	s = _mm256_or_si256(s, _mm256_set_epi16(255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0));
+
+	__m256i t = _mm256_add_epi16(_mm256_mullo_epi16(s, a), _mm256_mullo_epi16(d, inv_a));
+	t = _mm256_add_epi16(t, _mm256_add_epi16(_mm256_set1_epi16(1), _mm256_srli_epi16(t, 8)));
+	return _mm256_srli_epi16(t, 8);
+}
+
+SOFT_AVX2_FUNCTION
+static void blend_span_avx2(uint32_t* dst, const uint32_t* src, int n) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i opaque = _mm256_set1_epi32(0xFF000000);
+
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i s = _mm256_loadu_si256((const __m256i*) (src + i));
+		__m256i alpha = _mm256_and_si256(s, opaque);
+
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(alpha, opaque)) == -1) {
+			_mm256_storeu_si256((__m256i*) (dst + i), s);
+			continue;
+		}
+
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(alpha, zero)) == -1) {
+			continue;
+		}
+
+		__m256i d = _mm256_loadu_si256((const __m256i*) (dst + i));
+
+		// unpack and pack work within 128-bit lanes, so the order comes back the same
+		__m256i lo = blend_unpacked_avx2(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero));
+		__m256i hi = blend_unpacked_avx2(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero));
+
+		_mm256_storeu_si256((__m256i*) (dst + i), _mm256_packus_epi16(lo, hi));
+	}
+
+	blend_span_sse2(dst + i, src + i, n - i);
+}
+
+#endif
+
+static BlendSpanFunc blend_span = blend_span_scalar;
+
+static void pick_kernels() {
+	blend_span = blend_span_scalar;
+#ifdef SOFT_SSE2
+	blend_span = blend_span_sse2;
+#endif
+#ifdef SOFT_AVX2
+	if (SDL_HasAVX2()) {
+		blend_span = blend_span_avx2;
+	}
+#endif
+}
+
+bool CreateSoftFramebuffer(SoftFramebuffer* fb, int w, int h) {
+	*fb = {};
+
+	pick_kernels();
+
+	fb->w = w;
+	fb->h = h;
+	fb->pitch = (w + 7) & ~7;
+
+	// ecalloc doesn't align, so take 32 bytes extra
+	fb->memory = ecalloc(fb->pitch * h * sizeof(uint32_t) + 32, 1);
+	fb->pixels = (uint32_t*) (((uintptr_t) fb->memory + 31) & ~(uintptr_t) 31);
+
+	fb->surface = SDL_CreateRGBSurfaceWithFormatFrom(fb->pixels, w, h, 32, fb->pitch * sizeof(uint32_t), SDL_PIXELFORMAT_ARGB8888);
+	if (!fb->surface) {
+		DestroySoftFramebuffer(fb);
+		return false;
+	}
+
+	return true;
+}
+
+void DestroySoftFramebuffer(SoftFramebuffer* fb) {
+	if (bound_framebuffer == fb) {
+		bound_renderer = nullptr;
+		bound_framebuffer = nullptr;
+	}
+
+	if (fb->surface) SDL_FreeSurface(fb->surface);
+	fb->surface = nullptr;
+
+	if (fb->memory) free(fb->memory);
+	fb->memory = nullptr;
+	fb->pixels = nullptr;
+}
+
+void BindSoftFramebuffer(SDL_Renderer* renderer, SoftFramebuffer* fb) {
+	bound_renderer = renderer;
+	bound_framebuffer = fb;
+}
+
+SoftFramebuffer* GetSoftFramebuffer(SDL_Renderer* renderer) {
+	if (!renderer || renderer != bound_renderer) {
+		return nullptr;
+	}
+
+	if (SDL_GetRenderTarget(renderer)) {
+		return nullptr;
+	}
+
+	SDL_RenderFlush(renderer);
+	return bound_framebuffer;
+}
+
+SDL_Surface* LoadSoftSurface(const char* fname) {
+	SDL_Surface* loaded = IMG_Load(fname);
+	if (!loaded) {
+		return nullptr;
+	}
+
+	SDL_Surface* surface = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+	SDL_FreeSurface(loaded);
+	return surface;
+}
+
+static uint32_t* get_src_row(SDL_Surface* src, int y) {
+	return (uint32_t*) ((uint8_t*) src->pixels + y * src->pitch);
+}
+
+void SoftBlitTile(SoftFramebuffer* fb, SDL_Surface* src, SDL_Rect src_rect, int x, int y, int flip) {
+	if (src_rect.w > SOFT_MAX_SPAN) {
+		return;
+	}
+
+	int x0 = max(x, 0);
+	int x1 = min(x + src_rect.w, fb->w);
+	int y0 = max(y, 0);
+	int y1 = min(y + src_rect.h, fb->h);
+	if (x0 >= x1 || y0 >= y1) {
+		return;
+	}
+
+	uint32_t row[SOFT_MAX_SPAN];
+
+	for (int dy = y0; dy < y1; dy++) {
+		int sy = dy - y;
+		if (flip & SDL_FLIP_VERTICAL) {
+			sy = src_rect.h - 1 - sy;
+		}
+
+		const uint32_t* src_row = get_src_row(src, src_rect.y + sy) + src_rect.x;
+
+		if (flip & SDL_FLIP_HORIZONTAL) {
+			for (int i = 0; i < src_rect.w; i++) {
+				row[i] = src_row[src_rect.w - 1 - i];
+			}
+			src_row = row;
+		}
+
+		blend_span(&fb->pixels[x0 + dy * fb->pitch], src_row + (x0 - x), x1 - x0);
+	}
+}
+
+void SoftBlitSprite(SoftFramebuffer* fb, SDL_Surface* src, SDL_Rect src_rect, SDL_Rect dest, double angle, int flip) {
+	if (angle == 0.0 && src_rect.w == dest.w && src_rect.h == dest.h) {
+		SoftBlitTile(fb, src, src_rect, dest.x, dest.y, flip);
+		return;
+	}
+
+	if (dest.w <= 0 || dest.h <= 0) {
+		return;
+	}
+
+	double rad = angle * double(PI) / 180.0;
+	float c = (float) cos(rad);
+	float s = (float) sin(rad);
+
+	float center_x = float(dest.x) + float(dest.w) / 2.0f;
+	float center_y = float(dest.y) + float(dest.h) / 2.0f;
+
+	// bounding box of the rotated rectangle
+	float half_w = (fabsf(c) * float(dest.w) + fabsf(s) * float(dest.h)) / 2.0f;
+	float half_h = (fabsf(s) * float(dest.w) + fabsf(c) * float(dest.h)) / 2.0f;
+
+	int x0 = max((int) floorf(center_x - half_w), 0);
+	int x1 = min((int) ceilf (center_x + half_w), fb->w);
+	int y0 = max((int) floorf(center_y - half_h), 0);
+	int y1 = min((int) ceilf (center_y + half_h), fb->h);
+	if (x0 >= x1 || y0 >= y1 || x1 - x0 > SOFT_MAX_SPAN) {
+		return;
+	}
+
+	float scale_x = float(src_rect.w) / float(dest.w);
+	float scale_y = float(src_rect.h) / float(dest.h);
+
+	uint32_t row[SOFT_MAX_SPAN];
+
+	for (int dy = y0; dy < y1; dy++) {
+		for (int dx = x0; dx < x1; dx++) {
+			// rotate the pixel center back into the unrotated rectangle
+			float px = float(dx) + 0.5f - center_x;
+			float py = float(dy) + 0.5f - center_y;
+			float ux =  px * c + py * s + float(dest.w) / 2.0f;
+			float uy = -px * s + py * c + float(dest.h) / 2.0f;
+
+			int sx = (int) floorf(ux * scale_x);
+			int sy = (int) floorf(uy * scale_y);
+
+			uint32_t pixel = 0;
+			if (0 <= sx && sx < src_rect.w && 0 <= sy && sy < src_rect.h) {
+				if (flip & SDL_FLIP_HORIZONTAL) sx = src_rect.w - 1 - sx;
+				if (flip & SDL_FLIP_VERTICAL)   sy = src_rect.h - 1 - sy;
+				pixel = get_src_row(src, src_rect.y + sy)[src_rect.x + sx];
+			}
+
+			row[dx - x0] = pixel;
+		}
+
+		blend_span(&fb->pixels[x0 + dy * fb->pitch], row, x1 - x0);
+	}
+}
+
+void SoftBlitGlyph(SoftFramebuffer* fb, SDL_Surface* src, SDL_Rect src_rect, int x, int y, SDL_Color color) {
+	if (src_rect.w > SOFT_MAX_SPAN) {
+		return;
+	}
+
+	int x0 = max(x, 0);
+	int x1 = min(x + src_rect.w, fb->w);
+	int y0 = max(y, 0);
+	int y1 = min(y + src_rect.h, fb->h);
+	if (x0 >= x1 || y0 >= y1) {
+		return;
+	}
+
+	uint32_t row[SOFT_MAX_SPAN];
+
+	for (int dy = y0; dy < y1; dy++) {
+		const uint32_t* src_row = get_src_row(src, src_rect.y + (dy - y)) + src_rect.x + (x0 - x);
+
+		for (int i = 0; i < x1 - x0; i++) {
+			uint32_t p = src_row[i];
+			uint32_t r = (((p >> 16) & 0xFF) * color.r) / 255;
+			uint32_t g = (((p >>  8) & 0xFF) * color.g) / 255;
+			uint32_t b = (((p >>  0) & 0xFF) * color.b) / 255;
+			row[i] = (p & 0xFF000000) | (r << 16) | (g << 8) | b;
+		}
+
+		blend_span(&fb->pixels[x0 + dy * fb->pitch], row, x1 - x0);
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <SDL.h>
+#include <stdint.h>
+
+// An ARGB8888 framebuffer drawn into by the CPU. In offscreen mode the game
+// renders into one of these through SDL's software renderer, and the tiles,
+// sprites and glyphs are blitted straight into its pixels with the kernels
+// below, so no window or GPU is needed.
+struct SoftFramebuffer {
+	uint32_t* pixels; // every row starts 32-byte aligned
+	int w;
+	int h;
+	int pitch; // in pixels
+	void* memory;
+	SDL_Surface* surface; // wraps pixels
+};
+
+bool CreateSoftFramebuffer(SoftFramebuffer* fb, int w, int h);
+void DestroySoftFramebuffer(SoftFramebuffer* fb);
+
+// Draw calls through renderer end up in fb. Blitting straight into fb has
+// to flush the renderer first, see GetSoftFramebuffer.
+void BindSoftFramebuffer(SDL_Renderer* renderer, SoftFramebuffer* fb);
+
+// The framebuffer bound to renderer, or nullptr if there is none or the
+// renderer is drawing to a texture. Flushes the renderer, so what it drew so
+// far is in the pixels before anything is blitted on top.
+SoftFramebuffer* GetSoftFramebuffer(SDL_Renderer* renderer);
+
+// Loads an image as an ARGB8888 surface the blits can take.
+SDL_Surface* LoadSoftSurface(const char* fname);
+
+// Sources must be ARGB8888 surfaces. Everything is alpha blended like
+// SDL_BLENDMODE_BLEND and clipped to the framebuffer.
+void SoftBlitTile(SoftFramebuffer* fb, SDL_Surface* src, SDL_Rect src_rect, int x, int y, int flip);
+
+// Rotated clockwise by angle degrees about the center of dest, like SDL_RenderCopyEx.
+void SoftBlitSprite(SoftFramebuffer* fb, SDL_Surface* src, SDL_Rect src_rect, SDL_Rect dest, double angle, int flip);
+
+// The color multiplies the source, like SDL_SetTextureColorMod.
+void SoftBlitGlyph(SoftFramebuffer* fb, SDL_Surface* src, SDL_Rect src_rect, int x, int y, SDL_Color color);
@@ -0,0 +1,182 @@
+#include "TextCache.h"
+
+#include "SoftRenderer.h"
+
+static uint32_t hash_text(const char* text, Font* font, SDL_Color color, bool shadow) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (const char* it = text; *it; it++) {
+		hash ^= (uint8_t) *it;
+		hash *= 16777619u;
+	}
+
+	hash ^= (uint32_t) (uintptr_t) font;
+	hash *= 16777619u;
+	hash ^= (color.r << 24) | (color.g << 16) | (color.b << 8) | color.a;
+	hash *= 16777619u;
+	hash ^= shadow;
+	hash *= 16777619u;
+	return hash;
+}
+
+// Textures are allocated in steps so they can be reused for similar strings.
+static int round_up(int x, int step) {
+	return (x + step - 1) / step * step;
+}
+
+static bool render_entry(TextCacheEntry* entry, SDL_Renderer* renderer) {
+	SDL_Point size = MeasureText(entry->font, entry->text);
+	if (entry->shadow) {
+		size.x += 1;
+		size.y += 1;
+	}
+
+	entry->w = size.x;
+	entry->h = size.y;
+
+	if (entry->w <= 0 || entry->h <= 0) {
+		entry->end = {};
+		return true;
+	}
+
+	if (!entry->texture || entry->texture_w < entry->w || entry->texture_h < entry->h) {
+		if (entry->texture) SDL_DestroyTexture(entry->texture);
+
+		entry->texture_w = round_up(entry->w, 64);
+		entry->texture_h = round_up(entry->h, 16);
+		entry->texture = SDL_CreateTexture(renderer,
+										   SDL_PIXELFORMAT_ARGB8888,
+										   SDL_TEXTUREACCESS_TARGET,
+										   entry->texture_w, entry->texture_h);
+		if (!entry->texture) {
+			return false;
+		}
+
+		// glyphs blended onto a transparent texture come out premultiplied
+		SDL_BlendMode premultiplied = SDL_ComposeCustomBlendMode(SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+																 SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+		if (SDL_SetTextureBlendMode(entry->texture, premultiplied) != 0) {
+			SDL_SetTextureBlendMode(entry->texture, SDL_BLENDMODE_BLEND);
+		}
+	}
+
+	SDL_Texture* target = SDL_GetRenderTarget(renderer);
+	Uint8 r, g, b, a;
+	SDL_GetRenderDrawColor(renderer, &r, &g, &b, &a);
+
+	SDL_SetRenderTarget(renderer, entry->texture);
+	{
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+		SDL_RenderClear(renderer);
+
+		if (entry->shadow) {
+			entry->end = DrawTextShadow(renderer, entry->font, entry->text, 0, 0, HALIGN_LEFT, VALIGN_TOP, entry->color);
+		} else {
+			entry->end = DrawText(renderer, entry->font, entry->text, 0, 0, HALIGN_LEFT, VALIGN_TOP, entry->color);
+		}
+	}
+	SDL_SetRenderTarget(renderer, target);
+	SDL_SetRenderDrawColor(renderer, r, g, b, a);
+
+	return true;
+}
+
+static TextCacheEntry* find_entry(TextCache* cache, SDL_Renderer* renderer, Font* font, const char* text, SDL_Color color, bool shadow) {
+	uint32_t hash = hash_text(text, font, color, shadow);
+
+	for (int i = 0; i < cache->entry_count; i++) {
+		TextCacheEntry* entry = &cache->entries[i];
+		if (entry->hash == hash && entry->font == font && entry->shadow == shadow
+			&& entry->color.r == color.r && entry->color.g == color.g && entry->color.b == color.b && entry->color.a == color.a
+			&& SDL_strcmp(entry->text, text) == 0) {
+			entry->last_used = cache->frame;
+			cache->hits_last_frame++;
+			return entry;
+		}
+	}
+
+	// a free entry, or the least recently used one
+	TextCacheEntry* entry = nullptr;
+	if (cache->entry_count < TEXT_CACHE_CAPACITY) {
+		entry = &cache->entries[cache->entry_count++];
+	} else {
+		entry = &cache->entries[0];
+		for (int i = 1; i < cache->entry_count; i++) {
+			if (cache->entries[i].last_used < entry->last_used) {
+				entry = &cache->entries[i];
+			}
+		}
+
+		// still in use this frame, the cache is too small for what's on screen
+		if (entry->last_used == cache->frame) {
+			return nullptr;
+		}
+	}
+
+	entry->hash = hash;
+	entry->font = font;
+	entry->color = color;
+	entry->shadow = shadow;
+	SDL_strlcpy(entry->text, text, sizeof(entry->text));
+	entry->last_used = cache->frame;
+
+	cache->misses_last_frame++;
+
+	if (!render_entry(entry, renderer)) {
+		entry->hash = 0;
+		entry->font = nullptr;
+		return nullptr;
+	}
+
+	return entry;
+}
+
+void DestroyTextCache(TextCache* cache) {
+	for (int i = 0; i < cache->entry_count; i++) {
+		if (cache->entries[i].texture) SDL_DestroyTexture(cache->entries[i].texture);
+	}
+
+	*cache = {};
+}
+
+void InvalidateTextCache(TextCache* cache) {
+	// keep the textures, evicted entries reuse them
+	for (int i = 0; i < cache->entry_count; i++) {
+		TextCacheEntry* entry = &cache->entries[i];
+		entry->hash = 0;
+		entry->font = nullptr;
+		entry->last_used = 0;
+	}
+}
+
+void BeginTextCacheFrame(TextCache* cache) {
+	cache->frame++;
+	cache->hits_last_frame = 0;
+	cache->misses_last_frame = 0;
+}
+
+SDL_Point DrawTextCached(TextCache* cache, SDL_Renderer* renderer, Font* font, const char* text,
+						 int x, int y,
+						 SDL_Color color, bool shadow) {
+	TextCacheEntry* entry = nullptr;
+
+	// render targets don't work with the software renderer's framebuffer
+	if (SDL_strlen(text) < TEXT_CACHE_MAX_LENGTH && !GetSoftFramebuffer(renderer)) {
+		entry = find_entry(cache, renderer, font, text, color, shadow);
+	}
+
+	if (!entry) {
+		if (shadow) {
+			return DrawTextShadow(renderer, font, text, x, y, HALIGN_LEFT, VALIGN_TOP, color);
+		}
+		return DrawText(renderer, font, text, x, y, HALIGN_LEFT, VALIGN_TOP, color);
+	}
+
+	if (entry->w > 0 && entry->h > 0) {
+		SDL_Rect src = {0, 0, entry->w, entry->h};
+		SDL_Rect dest = {x, y, entry->w, entry->h};
+		SDL_RenderCopy(renderer, entry->texture, &src, &dest);
+	}
+
+	return {x + entry->end.x, y + entry->end.y};
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Font.h"
+
+#include <stdint.h>
+
+// Strings drawn into their own textures, shadow included, and reused while the
+// same string is drawn with the same font and color. Textures of evicted
+// strings are reused for new ones when they're big enough.
+#define TEXT_CACHE_CAPACITY 64
+#define TEXT_CACHE_MAX_LENGTH 128 // longer strings are drawn directly
+
+struct TextCacheEntry {
+	uint32_t hash;
+	Font* font;
+	SDL_Color color;
+	bool shadow;
+	char text[TEXT_CACHE_MAX_LENGTH];
+
+	SDL_Texture* texture;
+	int texture_w;
+	int texture_h;
+	int w; // used part of the texture
+	int h;
+	SDL_Point end; // what DrawText returned, relative to the text's position
+
+	uint32_t last_used;
+};
+
+struct TextCache {
+	TextCacheEntry entries[TEXT_CACHE_CAPACITY];
+	int entry_count;
+	uint32_t frame;
+
+	int hits_last_frame;
+	int misses_last_frame;
+};
+
+void DestroyTextCache(TextCache* cache);
+
+// Call on SDL_RENDER_TARGETS_RESET, which loses what's in the textures. The
+// strings are drawn again the next time they're used.
+void InvalidateTextCache(TextCache* cache);
+
+// Call at the start of a frame.
+void BeginTextCacheFrame(TextCache* cache);
+
+// Same as DrawText or DrawTextShadow with the top left alignment.
+SDL_Point DrawTextCached(TextCache* cache, SDL_Renderer* renderer, Font* font, const char* text,
+						 int x, int y,
+						 SDL_Color color = {255, 255, 255, 255}, bool shadow = true);
@@ -0,0 +1,178 @@
+#include "TileAtlas.h"
+
+#include "misc.h"
+#include "mathh.h"
+
+#define TILE_PIXELS (16 * 16)
+#define SLOT_SIZE (16 + 2 * TILE_ATLAS_PADDING)
+
+uint32_t HashTilePixels(const uint32_t* pixels) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < TILE_PIXELS; i++) {
+		hash ^= pixels[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+void ReadTilePixels(SDL_Surface* argb, SDL_Rect rect, uint32_t* pixels) {
+	for (int y = 0; y < 16; y++) {
+		for (int x = 0; x < 16; x++) {
+			int px = rect.x + x;
+			int py = rect.y + y;
+
+			uint32_t pixel = 0;
+			if (0 <= px && px < argb->w && 0 <= py && py < argb->h) {
+				pixel = ((uint32_t*) ((uint8_t*) argb->pixels + py * argb->pitch))[px];
+			}
+
+			pixels[x + y * 16] = pixel;
+		}
+	}
+}
+
+static int next_power_of_two(int x) {
+	int result = 1;
+	while (result < x) {
+		result *= 2;
+	}
+	return result;
+}
+
+bool BuildTileAtlas(TileAtlas* atlas, SDL_Surface* src, const SDL_Rect* src_rects, int tile_count) {
+	*atlas = {};
+
+	bool result = false;
+
+	SDL_Surface* converted = nullptr;
+	uint32_t* tiles = nullptr; // unique tiles, 16x16 pixels each
+	int* table = nullptr;      // hash table of unique tile indices, -1 = empty
+	int table_size = next_power_of_two(max(tile_count * 2, 16));
+	int* slots = nullptr;      // unique tile index for every tile
+
+	{
+		converted = SDL_ConvertSurfaceFormat(src, SDL_PIXELFORMAT_ARGB8888, 0);
+		if (!converted) {
+			goto out;
+		}
+
+		tiles = (uint32_t*) ecalloc(max(tile_count, 1), TILE_PIXELS * sizeof(*tiles));
+		table = (int*) ecalloc(table_size, sizeof(*table));
+		slots = (int*) ecalloc(max(tile_count, 1), sizeof(*slots));
+
+		for (int i = 0; i < table_size; i++) {
+			table[i] = -1;
+		}
+
+		SDL_LockSurface(converted);
+
+		int unique_count = 0;
+		for (int tile_index = 0; tile_index < tile_count; tile_index++) {
+			uint32_t* pixels = &tiles[unique_count * TILE_PIXELS];
+			ReadTilePixels(converted, src_rects[tile_index], pixels);
+
+			uint32_t hash = HashTilePixels(pixels);
+			int i = hash & (table_size - 1);
+			while (table[i] != -1) {
+				if (SDL_memcmp(&tiles[table[i] * TILE_PIXELS], pixels, TILE_PIXELS * sizeof(*pixels)) == 0) {
+					break;
+				}
+				i = (i + 1) & (table_size - 1);
+			}
+
+			if (table[i] == -1) {
+				table[i] = unique_count++;
+			}
+
+			slots[tile_index] = table[i];
+		}
+
+		SDL_UnlockSurface(converted);
+
+		// smallest power-of-two size that fits, the squarer one on ties
+		int best_w = 0;
+		int best_h = 0;
+		for (int tex_w = 32; tex_w <= TILE_ATLAS_MAX_SIZE; tex_w *= 2) {
+			int columns = tex_w / SLOT_SIZE;
+			int rows = (max(unique_count, 1) + columns - 1) / columns;
+			int tex_h = next_power_of_two(rows * SLOT_SIZE);
+			if (tex_h > TILE_ATLAS_MAX_SIZE) {
+				continue;
+			}
+
+			int area = tex_w * tex_h;
+			int best_area = best_w * best_h;
+			if (best_w == 0 || area < best_area
+				|| (area == best_area && abs(tex_w - tex_h) < abs(best_w - best_h))) {
+				best_w = tex_w;
+				best_h = tex_h;
+			}
+		}
+
+		if (best_w == 0) {
+			goto out;
+		}
+
+		atlas->surface = SDL_CreateRGBSurfaceWithFormat(0, best_w, best_h, 32, SDL_PIXELFORMAT_ARGB8888);
+		if (!atlas->surface) {
+			goto out;
+		}
+
+		atlas->src_rects = (SDL_Rect*) ecalloc(max(tile_count, 1), sizeof(*atlas->src_rects));
+		atlas->tile_count = tile_count;
+		atlas->unique_count = unique_count;
+
+		int columns = best_w / SLOT_SIZE;
+		int pitch = atlas->surface->pitch / 4;
+
+		for (int unique = 0; unique < unique_count; unique++) {
+			int slot_x = (unique % columns) * SLOT_SIZE;
+			int slot_y = (unique / columns) * SLOT_SIZE;
+
+			uint32_t* pixels = &tiles[unique * TILE_PIXELS];
+			uint32_t* dest = (uint32_t*) atlas->surface->pixels + slot_x + slot_y * pitch;
+
+			// the padding repeats the nearest edge pixel
+			for (int y = 0; y < SLOT_SIZE; y++) {
+				for (int x = 0; x < SLOT_SIZE; x++) {
+					int tx = clamp(x - TILE_ATLAS_PADDING, 0, 15);
+					int ty = clamp(y - TILE_ATLAS_PADDING, 0, 15);
+					dest[x + y * pitch] = pixels[tx + ty * 16];
+				}
+			}
+		}
+
+		for (int tile_index = 0; tile_index < tile_count; tile_index++) {
+			int unique = slots[tile_index];
+			atlas->src_rects[tile_index] = {
+				(unique % columns) * SLOT_SIZE + TILE_ATLAS_PADDING,
+				(unique / columns) * SLOT_SIZE + TILE_ATLAS_PADDING,
+				16,
+				16
+			};
+		}
+
+		result = true;
+	}
+
+out:
+	if (slots) free(slots);
+	if (table) free(table);
+	if (tiles) free(tiles);
+	if (converted) SDL_FreeSurface(converted);
+
+	if (!result) {
+		DestroyTileAtlas(atlas);
+	}
+
+	return result;
+}
+
+void DestroyTileAtlas(TileAtlas* atlas) {
+	if (atlas->src_rects) free(atlas->src_rects);
+	atlas->src_rects = nullptr;
+
+	if (atlas->surface) SDL_FreeSurface(atlas->surface);
+	atlas->surface = nullptr;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <SDL.h>
+
+// Packs 16x16 tiles into one power-of-two texture. Tiles with the same pixels
+// share a slot, and every slot has a 1 pixel border copied from the tile's
+// edges so filtering never picks up a neighbour.
+#define TILE_ATLAS_PADDING 1
+#define TILE_ATLAS_MAX_SIZE 4096
+
+struct TileAtlas {
+	SDL_Surface* surface; // ARGB8888
+	SDL_Rect* src_rects;  // where each tile ended up
+	int tile_count;
+	int unique_count;
+};
+
+// src_rects says where each tile is in src. Returns false if the tiles don't fit.
+bool BuildTileAtlas(TileAtlas* atlas, SDL_Surface* src, const SDL_Rect* src_rects, int tile_count);
+void DestroyTileAtlas(TileAtlas* atlas);
+
+// Copies a 16x16 tile out of an ARGB8888 surface, pixels outside of it are 0.
+void ReadTilePixels(SDL_Surface* argb, SDL_Rect rect, uint32_t* pixels);
+uint32_t HashTilePixels(const uint32_t* pixels);
@@ -0,0 +1,98 @@
+#include "TileBatch.h"
+
+#include "Game.h"
+
+#include "misc.h"
+#include "mathh.h"
+
+void TileBatch::Init() {
+	vertices = (SDL_Vertex*) ecalloc(TILE_BATCH_CAPACITY * 4, sizeof(*vertices));
+	indices  = (int*)        ecalloc(TILE_BATCH_CAPACITY * 6, sizeof(*indices));
+
+	// every quad is the same two triangles
+	for (int i = 0; i < TILE_BATCH_CAPACITY; i++) {
+		indices[i * 6 + 0] = i * 4 + 0;
+		indices[i * 6 + 1] = i * 4 + 1;
+		indices[i * 6 + 2] = i * 4 + 2;
+		indices[i * 6 + 3] = i * 4 + 2;
+		indices[i * 6 + 4] = i * 4 + 3;
+		indices[i * 6 + 5] = i * 4 + 0;
+	}
+}
+
+void TileBatch::Destroy() {
+	if (indices) free(indices);
+	indices = nullptr;
+
+	if (vertices) free(vertices);
+	vertices = nullptr;
+}
+
+void TileBatch::Begin(SDL_Texture* texture) {
+	this->texture = texture;
+	count = 0;
+
+	int w = 1;
+	int h = 1;
+	if (texture) {
+		SDL_QueryTexture(texture, nullptr, nullptr, &w, &h);
+	}
+	texture_w = float(w);
+	texture_h = float(h);
+}
+
+void TileBatch::Add(SDL_Rect src, SDL_Rect dest, int flip, SDL_Color color, float angle) {
+	if (count == TILE_BATCH_CAPACITY) {
+		Flush();
+	}
+
+	float u0 = float(src.x) / texture_w;
+	float v0 = float(src.y) / texture_h;
+	float u1 = float(src.x + src.w) / texture_w;
+	float v1 = float(src.y + src.h) / texture_h;
+
+	if (flip & SDL_FLIP_HORIZONTAL) {
+		float t = u0;
+		u0 = u1;
+		u1 = t;
+	}
+	if (flip & SDL_FLIP_VERTICAL) {
+		float t = v0;
+		v0 = v1;
+		v1 = t;
+	}
+
+	float x0 = float(dest.x);
+	float y0 = float(dest.y);
+	float x1 = float(dest.x + dest.w);
+	float y1 = float(dest.y + dest.h);
+
+	SDL_Vertex* v = &vertices[count * 4];
+	v[0] = {{x0, y0}, color, {u0, v0}};
+	v[1] = {{x1, y0}, color, {u1, v0}};
+	v[2] = {{x1, y1}, color, {u1, v1}};
+	v[3] = {{x0, y1}, color, {u0, v1}};
+
+	if (angle != 0.0f) {
+		float center_x = (x0 + x1) / 2.0f;
+		float center_y = (y0 + y1) / 2.0f;
+		float c = dcos(angle);
+		float s = dsin(angle);
+
+		for (int i = 0; i < 4; i++) {
+			float x = v[i].position.x - center_x;
+			float y = v[i].position.y - center_y;
+			v[i].position.x = center_x + x * c - y * s;
+			v[i].position.y = center_y + x * s + y * c;
+		}
+	}
+
+	count++;
+}
+
+void TileBatch::Flush() {
+	if (count > 0) {
+		SDL_RenderGeometry(game->renderer, texture, vertices, count * 4, indices, count * 6);
+	}
+	count = 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <SDL.h>
+
+#define TILE_BATCH_CAPACITY 4096 // tiles per SDL_RenderGeometry call
+
+// Collects textured quads from one texture and draws them with a single
+// SDL_RenderGeometry call. Flips are done by swapping the texture coordinates.
+// With no texture the quads are filled with their color.
+struct TileBatch {
+	SDL_Vertex* vertices;
+	int* indices;
+	int count;
+
+	SDL_Texture* texture;
+	float texture_w;
+	float texture_h;
+
+	void Init();
+	void Destroy();
+
+	void Begin(SDL_Texture* texture);
+	// Rotated clockwise by angle degrees about the center of dest, like SDL_RenderCopyEx.
+	void Add(SDL_Rect src, SDL_Rect dest, int flip, SDL_Color color = {255, 255, 255, 255}, float angle = 0.0f);
+
+	// Draws what was added so far. Also happens when the batch is full.
+	void Flush();
+};
@@ -0,0 +1,281 @@
+#include "TileDedup.h"
+
+#include "TileAtlas.h"
+#include "misc.h"
+#include "mathh.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DEDUP_SSE2
+#endif
+
+#define TILE_PIXELS (16 * 16)
+
+static bool tiles_equal(const uint32_t* a, const uint32_t* b) {
+#ifdef DEDUP_SSE2
+	// a row is 4 vectors, stop at the first row that differs
+	for (int y = 0; y < 16; y++) {
+		const __m128i* va = (const __m128i*) (a + y * 16);
+		const __m128i* vb = (const __m128i*) (b + y * 16);
+
+		__m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128(va + 0), _mm_loadu_si128(vb + 0));
+		eq = _mm_and_si128(eq, _mm_cmpeq_epi32(_mm_loadu_si128(va + 1), _mm_loadu_si128(vb + 1)));
+		eq = _mm_and_si128(eq, _mm_cmpeq_epi32(_mm_loadu_si128(va + 2), _mm_loadu_si128(vb + 2)));
+		eq = _mm_and_si128(eq, _mm_cmpeq_epi32(_mm_loadu_si128(va + 3), _mm_loadu_si128(vb + 3)));
+
+		if (_mm_movemask_epi8(eq) != 0xFFFF) {
+			return false;
+		}
+	}
+	return true;
+#else
+	return SDL_memcmp(a, b, TILE_PIXELS * sizeof(*a)) == 0;
+#endif
+}
+
+static void flip_tile(const uint32_t* src, uint32_t* dest, int flip) {
+	for (int y = 0; y < 16; y++) {
+		for (int x = 0; x < 16; x++) {
+			int sx = (flip & TILE_HFLIP) ? 15 - x : x;
+			int sy = (flip & TILE_VFLIP) ? 15 - y : y;
+			dest[x + y * 16] = src[sx + sy * 16];
+		}
+	}
+}
+
+// What the sensors read from a height or width value, see World::SensorCheckDown.
+static int floor_reading(int h) {
+	return (h <= 0x10) ? h : 0;
+}
+
+static int ceiling_reading(int h) {
+	if (h >= 0xF0) return 16 - (h - 0xF0);
+	if (h == 16) return 16;
+	return 0;
+}
+
+// Everything the four sensors can read from a tile placed with the given flip.
+// hflip reverses the heights and reads the widths from the other side, vflip
+// does the same the other way around.
+struct SensorView {
+	uint8_t down[16];
+	uint8_t up[16];
+	uint8_t right[16];
+	uint8_t left[16];
+};
+
+static SensorView get_sensor_view(TileSet* tileset, int tile_index, int flip) {
+	SensorView view = {};
+
+	uint8_t* heights = tileset->GetTileHeight(tile_index);
+	uint8_t* widths  = tileset->GetTileWidth(tile_index);
+
+	bool hflip = (flip & TILE_HFLIP) != 0;
+	bool vflip = (flip & TILE_VFLIP) != 0;
+
+	for (int i = 0; i < 16; i++) {
+		int h = heights[hflip ? 15 - i : i];
+		int w = widths [vflip ? 15 - i : i];
+
+		view.down[i]  = (uint8_t) (vflip ? ceiling_reading(h) : floor_reading(h));
+		view.up[i]    = (uint8_t) (vflip ? floor_reading(h) : ceiling_reading(h));
+		view.right[i] = (uint8_t) (hflip ? ceiling_reading(w) : floor_reading(w));
+		view.left[i]  = (uint8_t) (hflip ? floor_reading(w) : ceiling_reading(w));
+	}
+
+	return view;
+}
+
+// The ground angle a tile placed with the given flip gives, see World::GroundSensorCollision.
+static float get_ground_angle(TileSet* tileset, int tile_index, int flip) {
+	float angle = tileset->GetTileAngle(tile_index);
+	if (angle == -1.0f) {
+		return angle;
+	}
+
+	switch (flip) {
+		case TILE_HFLIP | TILE_VFLIP: return -(180.0f - angle);
+		case TILE_VFLIP:              return 180.0f - angle;
+		case TILE_HFLIP:              return -angle;
+	}
+	return angle;
+}
+
+// Does tile_index look like merged_index placed with flip, to the sensors?
+// The flips form a group, so if the unflipped tile matches, so does every other flip.
+static bool collision_equal(TileSet* tileset, int tile_index, int merged_index, int flip) {
+	SensorView a = get_sensor_view(tileset, tile_index, 0);
+	SensorView b = get_sensor_view(tileset, merged_index, flip);
+	if (SDL_memcmp(&a, &b, sizeof(a)) != 0) {
+		return false;
+	}
+
+	float angle_a = get_ground_angle(tileset, tile_index, 0);
+	float angle_b = get_ground_angle(tileset, merged_index, flip);
+	if (angle_a == -1.0f || angle_b == -1.0f) {
+		return angle_a == angle_b;
+	}
+
+	// ground_angle is only ever used wrapped
+	return fabsf(angle_difference(angle_a, angle_b)) < 0.01f;
+}
+
+static int next_power_of_two(int x) {
+	int result = 1;
+	while (result < x) {
+		result *= 2;
+	}
+	return result;
+}
+
+int DedupTileSet(TileSet* tileset, SDL_Surface* texture, TileRemap* remap) {
+	int result = -1;
+
+	int tile_count = tileset->tile_count;
+
+	SDL_Surface* converted = nullptr;
+	uint32_t* tiles = nullptr; // kept tiles, 16x16 pixels each
+	int* kept = nullptr;       // tileset index of every kept tile
+	int* table = nullptr;      // hash table of kept tiles, -1 = empty
+	bool* live = nullptr;      // tiles whose graphics change at run time
+	int table_size = next_power_of_two(max(tile_count * 2, 16));
+
+	{
+		converted = SDL_ConvertSurfaceFormat(texture, SDL_PIXELFORMAT_ARGB8888, 0);
+		if (!converted) {
+			goto out;
+		}
+
+		tiles = (uint32_t*) ecalloc(max(tile_count, 1), TILE_PIXELS * sizeof(*tiles));
+		kept  = (int*) ecalloc(max(tile_count, 1), sizeof(*kept));
+		table = (int*) ecalloc(table_size, sizeof(*table));
+
+		for (int i = 0; i < table_size; i++) {
+			table[i] = -1;
+		}
+
+		// an animation writes into its tile's slot and reads its frames' slots,
+		// so neither may end up sharing a slot with another tile
+		live = (bool*) ecalloc(max(tile_count, 1), sizeof(*live));
+		for (int i = 0; i < tile_count; i++) {
+			live[i] = tileset->IsTileLive(i);
+		}
+		for (int i = 0; i < tileset->tile_anim_count; i++) {
+			TileAnim* anim = &tileset->tile_anims[i];
+			live[anim->tile_index] = true;
+			for (int j = 0; j < anim->frame_count; j++) {
+				live[anim->frames[j]] = true;
+			}
+		}
+
+		SDL_LockSurface(converted);
+
+		int kept_count = 0;
+		for (int tile_index = 0; tile_index < tile_count; tile_index++) {
+			if (live[tile_index]) {
+				// kept, but not in the table, so nothing is merged into it
+				kept[kept_count] = tile_index;
+				remap[tile_index] = {kept_count, 0};
+				kept_count++;
+				continue;
+			}
+
+			uint32_t* pixels = &tiles[kept_count * TILE_PIXELS];
+			ReadTilePixels(converted, tileset->src_rects[tile_index], pixels);
+
+			// if a kept tile equals this one flipped, this one is that tile flipped back
+			bool found = false;
+			for (int flip = 0; flip < 4 && !found; flip++) {
+				uint32_t flipped[TILE_PIXELS];
+				flip_tile(pixels, flipped, flip);
+
+				uint32_t hash = HashTilePixels(flipped);
+				for (int i = hash & (table_size - 1); table[i] != -1; i = (i + 1) & (table_size - 1)) {
+					int k = table[i];
+					if (tiles_equal(&tiles[k * TILE_PIXELS], flipped)
+						&& collision_equal(tileset, tile_index, kept[k], flip)) {
+						remap[tile_index] = {k, flip};
+						found = true;
+						break;
+					}
+				}
+			}
+
+			if (found) {
+				continue;
+			}
+
+			uint32_t hash = HashTilePixels(pixels);
+			int i = hash & (table_size - 1);
+			while (table[i] != -1) {
+				i = (i + 1) & (table_size - 1);
+			}
+			table[i] = kept_count;
+
+			kept[kept_count] = tile_index;
+			remap[tile_index] = {kept_count, 0};
+			kept_count++;
+		}
+
+		SDL_UnlockSurface(converted);
+
+		// kept tiles are in order, so they can be moved down in place
+		for (int k = 0; k < kept_count; k++) {
+			int tile_index = kept[k];
+			tileset->tile_profiles[k] = tileset->tile_profiles[tile_index];
+			tileset->src_rects[k] = tileset->src_rects[tile_index];
+		}
+
+		tileset->tile_count = kept_count;
+
+		for (int i = 0; i < tileset->tile_anim_count; i++) {
+			TileAnim* anim = &tileset->tile_anims[i];
+			anim->tile_index = remap[anim->tile_index].index;
+			for (int j = 0; j < anim->frame_count; j++) {
+				anim->frames[j] = remap[anim->frames[j]].index;
+			}
+		}
+
+		// the per tile colors and flags are by tile index too
+		tileset->changed_tile_count = 0;
+		tileset->UpdateLiveTiles();
+
+		// the collision textures are laid out by tile index
+		tileset->DestroyCollisionTextures();
+
+		result = tile_count - kept_count;
+	}
+
+out:
+	if (live) free(live);
+	if (table) free(table);
+	if (kept) free(kept);
+	if (tiles) free(tiles);
+	if (converted) SDL_FreeSurface(converted);
+
+	return result;
+}
+
+void RemapTileMap(TileMap* tilemap, const TileRemap* remap, int remap_count) {
+	if (tilemap->regions) {
+		return;
+	}
+
+	for (int layer = 0; layer < tilemap->layer_count; layer++) {
+		for (int tile_y = 0; tile_y < tilemap->height; tile_y++) {
+			for (int tile_x = 0; tile_x < tilemap->width; tile_x++) {
+				Tile tile = tilemap->GetTile(tile_x, tile_y, layer);
+				if (tile.index >= remap_count) {
+					continue;
+				}
+
+				TileRemap r = remap[tile.index];
+				tile.index = r.index;
+				if (r.flip & TILE_HFLIP) tile.hflip = !tile.hflip;
+				if (r.flip & TILE_VFLIP) tile.vflip = !tile.vflip;
+
+				tilemap->SetTile(tile_x, tile_y, layer, tile);
+			}
+		}
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "TileSet.h"
+#include "TileMap.h"
+
+// Where a tile went after DedupTileSet. The map tile should use index, with
+// flip (TILE_HFLIP | TILE_VFLIP) toggled on top of its own flip bits.
+struct TileRemap {
+	int index;
+	int flip;
+};
+
+// Removes tiles that look and collide exactly like an earlier tile, or like
+// a mirrored copy of one. Collision counts as the same only if every sensor,
+// under every flip, reads the same heights, widths and angle as before.
+// Animated tiles, their frames and tiles with cycled colors are always kept
+// as they are, the animations are renumbered to match.
+// texture is the tileset image, with tiles at tileset->src_rects.
+// remap gets one entry per tile the tileset had. Returns the number of tiles
+// removed, or -1 if the texture couldn't be read.
+int DedupTileSet(TileSet* tileset, SDL_Surface* texture, TileRemap* remap);
+
+// Applies a remap to every layer. Does nothing for maps split into regions.
+void RemapTileMap(TileMap* tilemap, const TileRemap* remap, int remap_count);
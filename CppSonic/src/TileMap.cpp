@@ -2,8 +2,200 @@
 
 #include <SDL.h>
 #include "misc.h"
+#include "mathh.h"
+#include "Compression.h"
 
-void TileMap::LoadFromFile(const char* fname) {
+// Extra regions kept around the view: the loader thread fetches everything within
+// REGION_PREFETCH_RADIUS, and regions further than REGION_EVICT_RADIUS are freed.
+#define REGION_PREFETCH_RADIUS 1
+#define REGION_EVICT_RADIUS 2
+
+// Sensors reach up to 32 pixels away, and the camera lags behind the player.
+#define REGION_VIEW_MARGIN 64
+
+enum {
+	REGION_UNLOADED,
+	REGION_QUEUED,  // waiting for the loader thread
+	REGION_LOADING, // being read by the loader thread
+	REGION_RESIDENT
+};
+
+struct LoadedRegion {
+	int index;
+	TileMapRegion region;
+};
+
+struct RegionStreamer {
+	char* fname;
+	uint32_t* offsets;
+	SDL_RWops* f; // main thread's own handle for synchronous loads
+
+	SDL_Thread* thread;
+	SDL_mutex* mutex;
+	SDL_cond* cond;
+
+	// protected by mutex
+	bool quit;
+	uint8_t* states;
+	int* queue;
+	int queue_count;
+	LoadedRegion* done;
+	int done_count;
+
+	// main thread only
+	int* resident;
+	int resident_count;
+};
+
+void TileLayer::Allocate(int count) {
+	indices  = (uint16_t*) ecalloc(count, sizeof(*indices));
+	flips    = (uint8_t*)  ecalloc(count, sizeof(*flips));
+	solidity = (uint8_t*)  ecalloc(count, sizeof(*solidity));
+}
+
+void TileLayer::Free() {
+	if (solidity) free(solidity);
+	solidity = nullptr;
+
+	if (flips) free(flips);
+	flips = nullptr;
+
+	if (indices) free(indices);
+	indices = nullptr;
+}
+
+static void free_region(TileMapRegion* region) {
+	for (int i = 0; i < TILEMAP_MAX_LAYERS; i++) {
+		region->layers[i].Free();
+	}
+	region->resident = false;
+}
+
+static TileMapRegion load_region(TileMap* map, SDL_RWops* f, int index) {
+	int count = map->region_size * map->region_size;
+
+	TileMapRegion region = {};
+	region.resident = true;
+
+	// on disk the layers are arrays of Tile
+	Tile* tiles = (Tile*) ecalloc(count, sizeof(*tiles));
+
+	bool ok = (f && SDL_RWseek(f, map->streamer->offsets[index], RW_SEEK_SET) >= 0);
+
+	for (int layer = 0; layer < map->layer_count; layer++) {
+		region.layers[layer].Allocate(count);
+
+		// on a read error the rest of the region stays empty rather than half-loaded
+		ok = ok && LZ4ReadSection(f, tiles, count * sizeof(*tiles));
+		if (!ok) {
+			continue;
+		}
+
+		for (int i = 0; i < count; i++) {
+			region.layers[layer].Set(i, tiles[i]);
+		}
+	}
+
+	if (!ok) {
+		for (int layer = 0; layer < map->layer_count; layer++) {
+			SDL_memset(region.layers[layer].indices,  0, count * sizeof(*region.layers[layer].indices));
+			SDL_memset(region.layers[layer].flips,    0, count * sizeof(*region.layers[layer].flips));
+			SDL_memset(region.layers[layer].solidity, 0, count * sizeof(*region.layers[layer].solidity));
+		}
+	}
+
+	free(tiles);
+
+	return region;
+}
+
+static int region_loader_thread(void* userdata) {
+	TileMap* map = (TileMap*) userdata;
+	RegionStreamer* s = map->streamer;
+
+	SDL_RWops* f = SDL_RWFromFile(s->fname, "rb");
+
+	SDL_LockMutex(s->mutex);
+	while (!s->quit) {
+		if (s->queue_count == 0) {
+			SDL_CondWait(s->cond, s->mutex);
+			continue;
+		}
+
+		// most recently requested first
+		int index = s->queue[--s->queue_count];
+		s->states[index] = REGION_LOADING;
+
+		SDL_UnlockMutex(s->mutex);
+		TileMapRegion region = load_region(map, f, index);
+		SDL_LockMutex(s->mutex);
+
+		s->done[s->done_count++] = {index, region};
+		SDL_CondBroadcast(s->cond);
+	}
+	SDL_UnlockMutex(s->mutex);
+
+	if (f) SDL_RWclose(f);
+
+	return 0;
+}
+
+void TileMap::Create(int width, int height, int layer_count, const int* layer_flags, TileMapLayout layout) {
+	this->width  = width;
+	this->height = height;
+	this->tile_count = width * height;
+	this->stride = width + 2 * TILEMAP_BORDER;
+	this->blocks_x = (stride + 7) / 8;
+	this->layout = layout;
+	this->layer_count = clamp(layer_count, 0, TILEMAP_MAX_LAYERS);
+
+	for (int i = 0; i < this->layer_count; i++) {
+		if (layer_flags) {
+			this->layer_flags[i] = layer_flags[i];
+		} else {
+			this->layer_flags[i] = (i == 0) ? (TILE_LAYER_COLLISION | TILE_LAYER_BACKGROUND) : TILE_LAYER_COLLISION;
+		}
+
+		if (!regions) {
+			layers[i].Allocate(GetLayerSize());
+		}
+	}
+}
+
+void TileMap::SetLayout(TileMapLayout new_layout) {
+	if (regions || layout == new_layout) {
+		return;
+	}
+
+	TileMap old = *this;
+
+	layout = new_layout;
+
+	for (int i = 0; i < layer_count; i++) {
+		layers[i].Allocate(GetLayerSize());
+
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				layers[i].Set(GetIndex(x, y), old.layers[i].Get(old.GetIndex(x, y)));
+			}
+		}
+
+		old.layers[i].Free();
+	}
+}
+
+int TileMap::AddLayer(int flags) {
+	if (regions || layer_count == TILEMAP_MAX_LAYERS) {
+		return -1;
+	}
+
+	int layer = layer_count++;
+	layer_flags[layer] = flags;
+	layers[layer].Allocate(GetLayerSize());
+	return layer;
+}
+
+void TileMap::LoadFromFile(const char* fname, TileMapLayout layout) {
 	SDL_RWops* f = nullptr;
 
 	{
@@ -17,6 +209,33 @@ void TileMap::LoadFromFile(const char* fname) {
 		int width;
 		int height;
 		SDL_RWread(f, &width,  sizeof(width),  1);
+
+		int layer_count = 2;
+		int layer_flags[TILEMAP_MAX_LAYERS] = {};
+		bool has_layer_info = false;
+		if (width == TILEMAP_LAYERS_MAGIC) {
+			has_layer_info = true;
+			SDL_RWread(f, &layer_count, sizeof(layer_count), 1);
+
+			if (layer_count <= 0 || layer_count > TILEMAP_MAX_LAYERS) {
+				ErrorMessageBox("Tilemap layer count is invalid.");
+				goto out;
+			}
+
+			SDL_RWread(f, layer_flags, sizeof(*layer_flags), layer_count);
+			SDL_RWread(f, &width, sizeof(width), 1);
+		}
+
+		bool compressed = false;
+		bool split_into_regions = false;
+		if (width == LZ4_LEVEL_MAGIC) {
+			compressed = true;
+			SDL_RWread(f, &width, sizeof(width), 1);
+		} else if (width == TILEMAP_REGIONS_MAGIC) {
+			split_into_regions = true;
+			SDL_RWread(f, &width, sizeof(width), 1);
+		}
+
 		SDL_RWread(f, &height, sizeof(height), 1);
 
 		if (width <= 0 || height <= 0) {
@@ -33,18 +252,92 @@ void TileMap::LoadFromFile(const char* fname) {
 			ErrorMessageBox("Start position is invalid.");
 		}
 
-		this->width  = width;
-		this->height = height;
-		this->tile_count = width * height;
-
 		this->start_x = start_x;
 		this->start_y = start_y;
 
-		tiles_a = (Tile*) ecalloc(tile_count, sizeof(*tiles_a));
-		tiles_b = (Tile*) ecalloc(tile_count, sizeof(*tiles_b));
+		if (split_into_regions) {
+			int region_size;
+			SDL_RWread(f, &region_size, sizeof(region_size), 1);
+
+			if (region_size <= 0) {
+				ErrorMessageBox("Tilemap region size is invalid.");
+				goto out;
+			}
+
+			this->region_size = region_size;
+			regions_x = (width  + region_size - 1) / region_size;
+			regions_y = (height + region_size - 1) / region_size;
+
+			int region_count = regions_x * regions_y;
+
+			regions = (TileMapRegion*) ecalloc(region_count, sizeof(*regions));
+
+			// no layers are allocated with regions set
+			Create(width, height, layer_count, has_layer_info ? layer_flags : nullptr, layout);
+
+			streamer = (RegionStreamer*) ecalloc(1, sizeof(*streamer));
+			streamer->fname    = SDL_strdup(fname);
+			streamer->offsets  = (uint32_t*)     ecalloc(region_count, sizeof(*streamer->offsets));
+			streamer->states   = (uint8_t*)      ecalloc(region_count, sizeof(*streamer->states));
+			streamer->queue    = (int*)          ecalloc(region_count, sizeof(*streamer->queue));
+			streamer->done     = (LoadedRegion*) ecalloc(region_count, sizeof(*streamer->done));
+			streamer->resident = (int*)          ecalloc(region_count, sizeof(*streamer->resident));
+
+			SDL_RWread(f, streamer->offsets, sizeof(*streamer->offsets), region_count);
+
+			streamer->f = f;
+			f = nullptr;
+
+			streamer->mutex = SDL_CreateMutex();
+			streamer->cond = SDL_CreateCond();
+			streamer->thread = SDL_CreateThread(region_loader_thread, "region loader", this);
+			goto out;
+		}
+
+		Create(width, height, layer_count, has_layer_info ? layer_flags : nullptr, layout);
+
+		// on disk a layer is an array of Tile, it's read a row at a time
+		// straight into the planes
+		Tile* row = (Tile*) ecalloc(width, sizeof(*row));
 
-		SDL_RWread(f, tiles_a, sizeof(*tiles_a), tile_count);
-		SDL_RWread(f, tiles_b, sizeof(*tiles_b), tile_count);
+		for (int layer = 0; layer < layer_count; layer++) {
+			LZ4SectionReader* reader = nullptr;
+			bool ok = true;
+
+			if (compressed) {
+				reader = LZ4OpenSection(f);
+				ok = (reader != nullptr);
+			}
+
+			for (int y = 0; y < height && ok; y++) {
+				if (compressed) {
+					ok = LZ4ReadSectionPart(reader, row, width * sizeof(*row));
+				} else {
+					// a short file reads as empty tiles, like before
+					SDL_memset(row, 0, width * sizeof(*row));
+					SDL_RWread(f, row, sizeof(*row), width);
+				}
+
+				for (int x = 0; x < width && ok; x++) {
+					layers[layer].Set(GetIndex(x, y), row[x]);
+				}
+			}
+
+			if (compressed && !LZ4CloseSection(reader)) {
+				ok = false;
+			}
+
+			if (!ok) {
+				ErrorMessageBox("Tilemap data is corrupted.");
+
+				int size = GetLayerSize();
+				SDL_memset(layers[layer].indices,  0, size * sizeof(*layers[layer].indices));
+				SDL_memset(layers[layer].flips,    0, size * sizeof(*layers[layer].flips));
+				SDL_memset(layers[layer].solidity, 0, size * sizeof(*layers[layer].solidity));
+			}
+		}
+
+		free(row);
 	}
 
 out:
@@ -52,9 +345,159 @@ out:
 }
 
 void TileMap::Destroy() {
-	if (tiles_b) free(tiles_b);
-	tiles_b = nullptr;
+	if (streamer) {
+		RegionStreamer* s = streamer;
+
+		if (s->thread) {
+			SDL_LockMutex(s->mutex);
+			s->quit = true;
+			SDL_CondBroadcast(s->cond);
+			SDL_UnlockMutex(s->mutex);
+
+			SDL_WaitThread(s->thread, nullptr);
+		}
+
+		// finished after the last UpdateStreaming
+		for (int i = 0; i < s->done_count; i++) {
+			free_region(&s->done[i].region);
+		}
+
+		if (s->cond) SDL_DestroyCond(s->cond);
+		if (s->mutex) SDL_DestroyMutex(s->mutex);
+		if (s->f) SDL_RWclose(s->f);
+
+		free(s->resident);
+		free(s->done);
+		free(s->queue);
+		free(s->states);
+		free(s->offsets);
+		SDL_free(s->fname);
+		free(s);
+	}
+	streamer = nullptr;
+
+	if (regions) {
+		for (int i = 0; i < regions_x * regions_y; i++) {
+			free_region(&regions[i]);
+		}
+		free(regions);
+	}
+	regions = nullptr;
+
+	for (int i = 0; i < TILEMAP_MAX_LAYERS; i++) {
+		layers[i].Free();
+	}
+	layer_count = 0;
+}
+
+void TileMap::UpdateStreaming(float view_x, float view_y, int view_w, int view_h) {
+	if (!regions) {
+		return;
+	}
+
+	RegionStreamer* s = streamer;
+	int region_px = region_size * 16;
+
+	// regions the game can touch this frame
+	int x1 = clamp(int(floorf((view_x - REGION_VIEW_MARGIN) / region_px)), 0, regions_x - 1);
+	int y1 = clamp(int(floorf((view_y - REGION_VIEW_MARGIN) / region_px)), 0, regions_y - 1);
+	int x2 = clamp(int(floorf((view_x + view_w + REGION_VIEW_MARGIN) / region_px)), 0, regions_x - 1);
+	int y2 = clamp(int(floorf((view_y + view_h + REGION_VIEW_MARGIN) / region_px)), 0, regions_y - 1);
+
+	auto is_within = [&](int index, int radius) {
+		int region_x = index % regions_x;
+		int region_y = index / regions_x;
+		return (x1 - radius <= region_x && region_x <= x2 + radius
+				&& y1 - radius <= region_y && region_y <= y2 + radius);
+	};
+
+	SDL_LockMutex(s->mutex);
+
+	auto take_finished = [&]() {
+		for (int i = 0; i < s->done_count; i++) {
+			int index = s->done[i].index;
+			regions[index] = s->done[i].region;
+			s->states[index] = REGION_RESIDENT;
+			s->resident[s->resident_count++] = index;
+		}
+		s->done_count = 0;
+	};
+
+	take_finished();
+
+	// evict
+	for (int i = 0; i < s->resident_count;) {
+		int index = s->resident[i];
+		if (is_within(index, REGION_EVICT_RADIUS)) {
+			i++;
+			continue;
+		}
+
+		free_region(&regions[index]);
+		s->states[index] = REGION_UNLOADED;
+		s->resident[i] = s->resident[--s->resident_count];
+	}
+
+	// drop requests we've moved away from
+	for (int i = 0; i < s->queue_count;) {
+		int index = s->queue[i];
+		if (is_within(index, REGION_EVICT_RADIUS)) {
+			i++;
+			continue;
+		}
+
+		s->states[index] = REGION_UNLOADED;
+		s->queue[i] = s->queue[--s->queue_count];
+	}
+
+	// prefetch
+	bool requested = false;
+	for (int region_y = max(y1 - REGION_PREFETCH_RADIUS, 0); region_y <= min(y2 + REGION_PREFETCH_RADIUS, regions_y - 1); region_y++) {
+		for (int region_x = max(x1 - REGION_PREFETCH_RADIUS, 0); region_x <= min(x2 + REGION_PREFETCH_RADIUS, regions_x - 1); region_x++) {
+			int index = region_x + region_y * regions_x;
+			if (s->states[index] == REGION_UNLOADED && s->offsets[index] != 0) {
+				s->states[index] = REGION_QUEUED;
+				s->queue[s->queue_count++] = index;
+				requested = true;
+			}
+		}
+	}
+
+	if (requested) {
+		SDL_CondSignal(s->cond);
+	}
+
+	// the view itself can't wait
+	for (int region_y = y1; region_y <= y2; region_y++) {
+		for (int region_x = x1; region_x <= x2; region_x++) {
+			int index = region_x + region_y * regions_x;
+			if (s->offsets[index] == 0) {
+				continue;
+			}
+
+			while (s->states[index] != REGION_RESIDENT) {
+				if (s->states[index] == REGION_QUEUED) {
+					for (int i = 0; i < s->queue_count; i++) {
+						if (s->queue[i] == index) {
+							s->queue[i] = s->queue[--s->queue_count];
+							break;
+						}
+					}
+					s->states[index] = REGION_LOADING;
+
+					SDL_UnlockMutex(s->mutex);
+					TileMapRegion region = load_region(this, s->f, index);
+					SDL_LockMutex(s->mutex);
+
+					s->done[s->done_count++] = {index, region};
+				} else {
+					SDL_CondWait(s->cond, s->mutex);
+				}
+
+				take_finished();
+			}
+		}
+	}
 
-	if (tiles_a) free(tiles_a);
-	tiles_a = nullptr;
+	SDL_UnlockMutex(s->mutex);
 }
@@ -1,47 +1,230 @@
 #pragma once
 
+#include <stdint.h>
+
 struct Tile {
 	int index;
 	bool hflip : 1;
 	bool vflip : 1;
 	bool top_solid : 1;
 	bool left_right_bottom_solid : 1;
+	bool priority : 1; // drawn in front of sprites
+};
+
+// A level has up to TILEMAP_MAX_LAYERS layers, each with a combination of these.
+// Collision layers are what the sensors look at (the player's layer n is the
+// n-th collision layer, see GetCollisionLayer), background layers are drawn
+// behind sprites and foreground layers in front.
+#define TILEMAP_MAX_LAYERS 8
+
+enum {
+	TILE_LAYER_COLLISION  = 1,
+	TILE_LAYER_BACKGROUND = 1 << 1,
+	TILE_LAYER_FOREGROUND = 1 << 2
+};
+
+// Tilemap files exported with layer info start with this,
+// followed by the layer count and an int of TILE_LAYER_* flags per layer, then the
+// file as before with one array (or LZ4 section) per layer instead of two.
+// Files without it have layer A (collision, background) and layer B (collision).
+#define TILEMAP_LAYERS_MAGIC int(0xC54C4159)
+
+// Tilemaps split into regions on disk start with this instead of the width.
+// After the usual header comes the region size (in tiles), a table of file
+// offsets for every region (0 = region is empty) and the regions themselves,
+// each as an LZ4 section per layer.
+#define TILEMAP_REGIONS_MAGIC int(0xC5524753)
+#define TILEMAP_REGION_SIZE 32
+
+// Resident layers are surrounded by this many rows and columns of empty tiles,
+// so lookups next to any tile of the map don't need a bounds check.
+#define TILEMAP_BORDER 2
+
+enum {
+	TILE_HFLIP = 1,
+	TILE_VFLIP = 1 << 1,
+	TILE_PRIORITY = 1 << 2
+};
+
+enum {
+	TILE_TOP_SOLID = 1,
+	TILE_LEFT_RIGHT_BOTTOM_SOLID = 1 << 1
+};
+
+// A layer is kept as separate planes, so drawing doesn't read solidity
+// and nothing but the sensors does.
+struct TileLayer {
+	uint16_t* indices;
+	uint8_t* flips;    // TILE_HFLIP, TILE_VFLIP, TILE_PRIORITY
+	uint8_t* solidity; // TILE_TOP_SOLID, TILE_LEFT_RIGHT_BOTTOM_SOLID
+
+	void Allocate(int count);
+	void Free();
+
+	Tile Get(int i) {
+		Tile tile = {};
+		tile.index = indices[i];
+		tile.hflip = flips[i] & TILE_HFLIP;
+		tile.vflip = flips[i] & TILE_VFLIP;
+		tile.priority = flips[i] & TILE_PRIORITY;
+		tile.top_solid = solidity[i] & TILE_TOP_SOLID;
+		tile.left_right_bottom_solid = solidity[i] & TILE_LEFT_RIGHT_BOTTOM_SOLID;
+		return tile;
+	}
+
+	// solidity is left unset
+	Tile GetGraphic(int i) {
+		Tile tile = {};
+		tile.index = indices[i];
+		tile.hflip = flips[i] & TILE_HFLIP;
+		tile.vflip = flips[i] & TILE_VFLIP;
+		tile.priority = flips[i] & TILE_PRIORITY;
+		return tile;
+	}
+
+	void Set(int i, Tile tile) {
+		indices[i] = (uint16_t) tile.index;
+		flips[i] = (tile.hflip ? TILE_HFLIP : 0) | (tile.vflip ? TILE_VFLIP : 0) | (tile.priority ? TILE_PRIORITY : 0);
+		solidity[i] = (tile.top_solid ? TILE_TOP_SOLID : 0) | (tile.left_right_bottom_solid ? TILE_LEFT_RIGHT_BOTTOM_SOLID : 0);
+	}
+};
+
+struct TileMapRegion {
+	TileLayer layers[TILEMAP_MAX_LAYERS]; // only allocated while resident
+	bool resident;
+};
+
+struct RegionStreamer;
+
+enum struct TileMapLayout {
+	ROW_MAJOR,
+
+	// 8x8 tile blocks, Z-order inside a block. A 4x4 group of tiles is 2 cache
+	// lines, so vertical sensor steps mostly stay within the lines already loaded.
+	BLOCKED
 };
 
 struct TileMap {
-	Tile* tiles_a;
-	Tile* tiles_b;
+	TileLayer layers[TILEMAP_MAX_LAYERS]; // including the border, use GetIndex
+	int layer_flags[TILEMAP_MAX_LAYERS];
+	int layer_count;
 	int tile_count;
 	int width;
 	int height;
+	int stride; // width + 2 * TILEMAP_BORDER
+	int blocks_x;
+	TileMapLayout layout;
 	float start_x;
 	float start_y;
 
-	void LoadFromFile(const char* fname);
+	// Only used for maps split into regions. The layers are empty then,
+	// and UpdateStreaming keeps the regions around the view resident.
+	TileMapRegion* regions;
+	int region_size;
+	int regions_x;
+	int regions_y;
+	RegionStreamer* streamer;
+
+	// Without flags, the layers are set up like the old layer A and B.
+	void Create(int width, int height, int layer_count = 2, const int* layer_flags = nullptr,
+				TileMapLayout layout = TileMapLayout::ROW_MAJOR);
+	void LoadFromFile(const char* fname, TileMapLayout layout = TileMapLayout::ROW_MAJOR);
 	void Destroy();
 
-	Tile GetTileA(int tile_x, int tile_y) {
-		if (0 <= tile_x && tile_x < width && 0 <= tile_y && tile_y < height) {
-			int index = tile_x + tile_y * width;
-			return tiles_a[index];
+	// Rearranges the resident layers. Does nothing for maps split into regions.
+	void SetLayout(TileMapLayout new_layout);
+
+	// Appends an empty layer. Returns its index, or -1.
+	int AddLayer(int flags);
+
+	// The index of the n-th collision layer, or -1 if there are fewer.
+	int GetCollisionLayer(int n) {
+		for (int i = 0; i < layer_count; i++) {
+			if (layer_flags[i] & TILE_LAYER_COLLISION) {
+				if (n == 0) {
+					return i;
+				}
+				n--;
+			}
 		}
-		return {};
+		return -1;
 	}
 
-	Tile GetTileB(int tile_x, int tile_y) {
-		if (0 <= tile_x && tile_x < width && 0 <= tile_y && tile_y < height) {
-			int index = tile_x + tile_y * width;
-			return tiles_b[index];
+	// Call before anything reads tiles in a frame. Regions overlapping the view
+	// (plus a margin) are made resident before returning, so what the game sees
+	// never depends on how far the loader thread has got.
+	void UpdateStreaming(float view_x, float view_y, int view_w, int view_h);
+
+	Tile GetRegionTile(int tile_x, int tile_y, int layer) {
+		int region_x = tile_x / region_size;
+		int region_y = tile_y / region_size;
+		TileMapRegion* region = &regions[region_x + region_y * regions_x];
+
+		// not resident: reads as empty
+		if (!region->resident) {
+			return {};
 		}
-		return {};
+
+		int index = (tile_x % region_size) + (tile_y % region_size) * region_size;
+		return region->layers[layer].Get(index);
+	}
+
+	int GetLayerSize() {
+		if (layout == TileMapLayout::BLOCKED) {
+			return blocks_x * ((height + 2 * TILEMAP_BORDER + 7) / 8) * 64;
+		}
+		return stride * (height + 2 * TILEMAP_BORDER);
+	}
+
+	int GetIndex(int tile_x, int tile_y) {
+		int x = tile_x + TILEMAP_BORDER;
+		int y = tile_y + TILEMAP_BORDER;
+
+		if (layout == TileMapLayout::BLOCKED) {
+			// interleave the low 3 bits of x and y
+			auto spread = [](int v) { return (v & 1) | ((v & 2) << 1) | ((v & 4) << 2); };
+			int block = (x >> 3) + (y >> 3) * blocks_x;
+			return block * 64 + (spread(x & 7) | (spread(y & 7) << 1));
+		}
+
+		return x + y * stride;
+	}
+
+	// No bounds check: tile_x and tile_y may be at most TILEMAP_BORDER tiles
+	// outside the map, and layer must be less than layer_count.
+	Tile GetTileUnchecked(int tile_x, int tile_y, int layer) {
+		if (regions) {
+			return GetTile(tile_x, tile_y, layer);
+		}
+		return layers[layer].Get(GetIndex(tile_x, tile_y));
+	}
+
+	// Same, but only reads the index and flip planes.
+	Tile GetTileGraphicUnchecked(int tile_x, int tile_y, int layer) {
+		if (regions) {
+			return GetTile(tile_x, tile_y, layer);
+		}
+		return layers[layer].GetGraphic(GetIndex(tile_x, tile_y));
 	}
 
 	Tile GetTile(int tile_x, int tile_y, int layer) {
-		if (layer == 0) {
-			return GetTileA(tile_x, tile_y);
-		} else if (layer == 1) {
-			return GetTileB(tile_x, tile_y);
+		if (0 <= tile_x && tile_x < width && 0 <= tile_y && tile_y < height
+			&& 0 <= layer && layer < layer_count) {
+			if (regions) {
+				return GetRegionTile(tile_x, tile_y, layer);
+			}
+			return layers[layer].Get(GetIndex(tile_x, tile_y));
 		}
 		return {};
 	}
+
+	void SetTile(int tile_x, int tile_y, int layer, Tile tile) {
+		if (regions) {
+			return;
+		}
+		if (0 <= tile_x && tile_x < width && 0 <= tile_y && tile_y < height
+			&& 0 <= layer && layer < layer_count) {
+			layers[layer].Set(GetIndex(tile_x, tile_y), tile);
+		}
+	}
 };
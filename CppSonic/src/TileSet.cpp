@@ -4,9 +4,12 @@
 
 #include <SDL_image.h>
 #include "misc.h"
+#include "mathh.h"
+#include "Compression.h"
 
-void TileSet::LoadFromFile(const char* binary_filepath, const char* texture_filepath) {
+bool TileSet::LoadFromFile(const char* binary_filepath, const char* texture_filepath) {
 	auto load_binary = [this](const char* binary_filepath) {
+		bool result = false;
 		SDL_RWops* f = nullptr;
 
 		{
@@ -20,129 +23,641 @@ void TileSet::LoadFromFile(const char* binary_filepath, const char* texture_file
 			int tile_count;
 			SDL_RWread(f, &tile_count, sizeof(tile_count), 1);
 
+			bool compressed = false;
+			if (tile_count == LZ4_LEVEL_MAGIC) {
+				compressed = true;
+				SDL_RWread(f, &tile_count, sizeof(tile_count), 1);
+			}
+
+			int profile_count = 0;
+			if (tile_count == TILESET_PROFILES_MAGIC) {
+				SDL_RWread(f, &profile_count, sizeof(profile_count), 1);
+				SDL_RWread(f, &tile_count, sizeof(tile_count), 1);
+
+				if (profile_count <= 0 || profile_count > TILESET_MAX_PROFILES) {
+					ErrorMessageBox("Invalid tileset profile count.");
+					goto out;
+				}
+			}
+
 			if (tile_count <= 0) {
 				ErrorMessageBox("Invalid tileset size.");
 				goto out;
 			}
 
-			this->tile_count = tile_count;
+			if (profile_count > 0) {
+				AllocateProfiles(profile_count, tile_count);
 
-			tile_heights = (uint8_t*) ecalloc(tile_count, sizeof(*tile_heights) * 16);
-			tile_widths  = (uint8_t*) ecalloc(tile_count, sizeof(*tile_widths)  * 16);
-			tile_angles  = (float*)   ecalloc(tile_count, sizeof(*tile_angles));
+				if (compressed) {
+					if (!LZ4ReadSection(f, profile_heights, profile_count * 16 * sizeof(*profile_heights))
+						|| !LZ4ReadSection(f, profile_widths, profile_count * 16 * sizeof(*profile_widths))
+						|| !LZ4ReadSection(f, profile_angles, profile_count * sizeof(*profile_angles))
+						|| !LZ4ReadSection(f, tile_profiles, tile_count * sizeof(*tile_profiles))) {
+						ErrorMessageBox("Tileset data is corrupted.");
+					}
+				} else {
+					SDL_RWread(f, profile_heights, 16 * sizeof(*profile_heights), profile_count);
+					SDL_RWread(f, profile_widths,  16 * sizeof(*profile_widths), profile_count);
+					SDL_RWread(f, profile_angles,  sizeof(*profile_angles), profile_count);
+					SDL_RWread(f, tile_profiles,   sizeof(*tile_profiles), tile_count);
+				}
+
+				for (int i = 0; i < tile_count; i++) {
+					if (tile_profiles[i] >= profile_count) {
+						ErrorMessageBox("Tileset data is corrupted.");
+						SDL_memset(tile_profiles, 0, tile_count * sizeof(*tile_profiles));
+						break;
+					}
+				}
 
-			SDL_RWread(f, tile_heights, 16 * sizeof(*tile_heights), tile_count);
-			SDL_RWread(f, tile_widths,  16 * sizeof(*tile_widths), tile_count);
-			SDL_RWread(f, tile_angles,  sizeof(*tile_angles), tile_count);
+				UpdateProfileRecords();
+			} else {
+				// older tilesets store a copy of the shape for every tile
+				uint8_t* heights = (uint8_t*) ecalloc(tile_count, 16 * sizeof(*heights));
+				uint8_t* widths  = (uint8_t*) ecalloc(tile_count, 16 * sizeof(*widths));
+				float*   angles  = (float*)   ecalloc(tile_count, sizeof(*angles));
+
+				if (compressed) {
+					if (!LZ4ReadSection(f, heights, tile_count * 16 * sizeof(*heights))
+						|| !LZ4ReadSection(f, widths, tile_count * 16 * sizeof(*widths))
+						|| !LZ4ReadSection(f, angles, tile_count * sizeof(*angles))) {
+						ErrorMessageBox("Tileset data is corrupted.");
+					}
+				} else {
+					SDL_RWread(f, heights, 16 * sizeof(*heights), tile_count);
+					SDL_RWread(f, widths,  16 * sizeof(*widths), tile_count);
+					SDL_RWread(f, angles,  sizeof(*angles), tile_count);
+				}
+
+				bool fits = SetProfilesFromTiles(heights, widths, angles, tile_count);
+
+				free(angles);
+				free(widths);
+				free(heights);
+
+				if (!fits) {
+					ErrorMessageBox("Tileset has more than %d collision shapes.", TILESET_MAX_PROFILES);
+					goto out;
+				}
+			}
+
+			// the atlas table is optional
+			int src_rect_count = 0;
+			if (SDL_RWread(f, &src_rect_count, sizeof(src_rect_count), 1) == 1 && src_rect_count == tile_count) {
+				src_rects = (SDL_Rect*) ecalloc(tile_count, sizeof(*src_rects));
+
+				if (compressed) {
+					if (!LZ4ReadSection(f, src_rects, tile_count * sizeof(*src_rects))) {
+						ErrorMessageBox("Tileset data is corrupted.");
+					}
+				} else {
+					SDL_RWread(f, src_rects, sizeof(*src_rects), tile_count);
+				}
+			}
+
+			result = true;
 		}
 
 	out:
 		if (f) SDL_RWclose(f);
+		return result;
 	};
 
 	auto load_texture = [this](const char* texture_filepath) {
-		texture = IMG_LoadTexture(game->renderer, texture_filepath);
+		if (LoadIndexedImage(&indexed, texture_filepath, game->renderer, TILESET_SLOT_SIZE)) {
+			texture = indexed.texture;
+		} else {
+			texture = IMG_LoadTexture(game->renderer, texture_filepath);
+		}
 
 		if (!texture) {
 			ErrorMessageBox("Couldn't load tileset texture.");
 			return;
 		}
 
-		int w;
-		int h;
-		SDL_QueryTexture(texture, nullptr, nullptr, &w, &h);
+		if (!src_rects) {
+			int w;
+			int h;
+			SDL_QueryTexture(texture, nullptr, nullptr, &w, &h);
 
-		// tiles_in_row = w / 16;
+			SetGridSrcRects(w / TILESET_SLOT_SIZE, 1);
+		}
+
+		UpdateLiveTiles();
+
+		if (GetSoftFramebuffer(game->renderer)) {
+			if (indexed.pixels) {
+				surface = SDL_CreateRGBSurfaceWithFormat(0, indexed.w, indexed.h, 32, SDL_PIXELFORMAT_ARGB8888);
+				if (surface) AttachIndexedSurface(&indexed, surface);
+			} else {
+				surface = LoadSoftSurface(texture_filepath);
+			}
+		}
 	};
 
-	load_binary(binary_filepath);
+	if (!load_binary(binary_filepath)) {
+		return false;
+	}
 	load_texture(texture_filepath);
 
-	if (texture) {
-		GenCollisionTextures();
+	// collision textures are made when an overlay first asks for them
+	return true;
+}
+
+// the tile and its padding
+static SDL_Rect get_slot_rect(SDL_Rect src) {
+	return {src.x - 1, src.y - 1, src.w + 2, src.h + 2};
+}
+
+void TileSet::LoadPaletteCycles(const char* fname) {
+	char* text = (char*) SDL_LoadFile(fname, nullptr);
+	if (!text) {
+		return;
+	}
+
+	for (char* line = text; *line;) {
+		char* next = line;
+		while (*next && *next != '\n') next++;
+		if (*next) *next++ = 0;
+
+		int frames_per_step = 0;
+		int pos = 0;
+		if (line[0] != '#' && SDL_sscanf(line, "%d%n", &frames_per_step, &pos) == 1) {
+			uint32_t colors[INDEXED_MAX_CYCLE_COLORS];
+			int count = 0;
+
+			unsigned int color;
+			int n;
+			while (count < INDEXED_MAX_CYCLE_COLORS && SDL_sscanf(line + pos, "%x%n", &color, &n) == 1) {
+				colors[count++] = 0xFF000000 | color;
+				pos += n;
+			}
+
+			if (!AddPaletteCycle(&indexed, colors, count, frames_per_step)) {
+				SDL_Log("Couldn't add palette cycle \"%s\".", line);
+			}
+		}
+
+		line = next;
+	}
+
+	SDL_free(text);
+
+	UpdateLiveTiles();
+}
+
+void TileSet::LoadTileAnims(const char* fname) {
+	char* text = (char*) SDL_LoadFile(fname, nullptr);
+	if (!text) {
+		return;
+	}
+
+	if (!indexed.pixels) {
+		SDL_Log("Tile animations need a tileset with at most 256 colors.");
+		SDL_free(text);
+		return;
+	}
+
+	int capacity = 16;
+	if (tile_anims) free(tile_anims);
+	tile_anims = (TileAnim*) ecalloc(capacity, sizeof(*tile_anims));
+	tile_anim_count = 0;
+
+	for (char* line = text; *line;) {
+		char* next = line;
+		while (*next && *next != '\n') next++;
+		if (*next) *next++ = 0;
+
+		TileAnim anim = {};
+		int pos = 0;
+		if (line[0] != '#' && SDL_sscanf(line, "%d %d%n", &anim.frames_per_step, &anim.tile_index, &pos) == 2) {
+			int frame;
+			int n;
+			while (anim.frame_count < TILESET_MAX_ANIM_FRAMES && SDL_sscanf(line + pos, "%d%n", &frame, &n) == 1) {
+				anim.frames[anim.frame_count++] = frame;
+				pos += n;
+			}
+
+			bool valid = (anim.frame_count > 0 && 0 <= anim.tile_index && anim.tile_index < tile_count);
+			for (int i = 0; i < anim.frame_count; i++) {
+				if (anim.frames[i] < 0 || anim.frames[i] >= tile_count) valid = false;
+			}
+
+			if (valid) {
+				// tiles with the same pixels share a slot in an atlas, and would animate too
+				SDL_Rect rect = GetTextureSrcRect(anim.tile_index);
+				for (int i = 0; i < tile_count; i++) {
+					SDL_Rect other = GetTextureSrcRect(i);
+					if (i != anim.tile_index && other.x == rect.x && other.y == rect.y) {
+						SDL_Log("Animated tile %d shares its graphics with tile %d.", anim.tile_index, i);
+						break;
+					}
+				}
+
+				anim.frames_per_step = max(anim.frames_per_step, 1);
+				anim.timer = anim.frames_per_step;
+
+				if (tile_anim_count == capacity) {
+					capacity *= 2;
+					TileAnim* anims = (TileAnim*) ecalloc(capacity, sizeof(*anims));
+					SDL_memcpy(anims, tile_anims, tile_anim_count * sizeof(*anims));
+					free(tile_anims);
+					tile_anims = anims;
+				}
+				tile_anims[tile_anim_count++] = anim;
+			} else {
+				SDL_Log("Couldn't add tile animation \"%s\".", line);
+			}
+		}
+
+		line = next;
+	}
+
+	SDL_free(text);
+
+	// start on the first frame
+	for (int i = 0; i < tile_anim_count; i++) {
+		TileAnim* anim = &tile_anims[i];
+		SDL_Rect src = GetTextureSrcRect(anim->frames[0]);
+		SDL_Rect dest = GetTextureSrcRect(anim->tile_index);
+
+		// the 1 pixel padding around the tile goes with it
+		CopyIndexedRect(&indexed, get_slot_rect(src), dest.x - 1, dest.y - 1);
+	}
+
+	UpdateLiveTiles();
+}
+
+void TileSet::UpdateLiveTiles() {
+	if (!indexed.pixels) {
+		return;
+	}
+
+	if (!tile_graphics) {
+		tile_colors   = (uint64_t*) ecalloc(max(tile_count, 1), 4 * sizeof(*tile_colors));
+		tile_graphics = (uint8_t*)  ecalloc(max(tile_count, 1), sizeof(*tile_graphics));
+		changed_tiles = (int*)      ecalloc(max(tile_count, 1), sizeof(*changed_tiles));
+	}
+	changed_tile_count = 0;
+
+	uint64_t cycled[4] = {};
+	for (int i = 0; i < indexed.cycle_count; i++) {
+		PaletteCycle* cycle = &indexed.cycles[i];
+		for (int j = 0; j < cycle->count; j++) {
+			cycled[cycle->indices[j] / 64] |= uint64_t(1) << (cycle->indices[j] % 64);
+		}
+	}
+
+	for (int i = 0; i < tile_count; i++) {
+		uint64_t* colors = &tile_colors[i * 4];
+		GetIndexedRectColors(&indexed, get_slot_rect(GetTextureSrcRect(i)), colors);
+
+		bool live = ((colors[0] & cycled[0]) || (colors[1] & cycled[1])
+					 || (colors[2] & cycled[2]) || (colors[3] & cycled[3]));
+		tile_graphics[i] = live ? TILE_GRAPHICS_LIVE : 0;
+	}
+
+	for (int i = 0; i < tile_anim_count; i++) {
+		tile_graphics[tile_anims[i].tile_index] |= TILE_GRAPHICS_LIVE;
+	}
+}
+
+void TileSet::ReleaseStaticGraphics() {
+	if (!tile_graphics) {
+		return;
+	}
+
+	for (int i = 0; i < tile_count; i++) {
+		if (tile_graphics[i] & TILE_GRAPHICS_LIVE) {
+			return;
+		}
+	}
+
+	if (changed_tiles) free(changed_tiles);
+	if (tile_graphics) free(tile_graphics);
+	if (tile_colors) free(tile_colors);
+	changed_tiles = nullptr;
+	tile_graphics = nullptr;
+	tile_colors = nullptr;
+	changed_tile_count = 0;
+
+	ReleaseIndexedPixels(&indexed);
+}
+
+bool TileSet::UpdateGraphics() {
+	if (!tile_graphics) {
+		return false;
+	}
+
+	for (int i = 0; i < changed_tile_count; i++) {
+		tile_graphics[changed_tiles[i]] &= ~TILE_GRAPHICS_CHANGED;
+	}
+	changed_tile_count = 0;
+
+	auto mark_changed = [this](int tile_index) {
+		if (!(tile_graphics[tile_index] & TILE_GRAPHICS_CHANGED)) {
+			tile_graphics[tile_index] |= TILE_GRAPHICS_CHANGED;
+			changed_tiles[changed_tile_count++] = tile_index;
+		}
+	};
+
+	for (int i = 0; i < tile_anim_count; i++) {
+		TileAnim* anim = &tile_anims[i];
+		if (--anim->timer > 0) {
+			continue;
+		}
+		anim->timer = anim->frames_per_step;
+
+		int frame = (anim->frame + 1) % anim->frame_count;
+		if (frame == anim->frame) {
+			continue;
+		}
+		anim->frame = frame;
+
+		SDL_Rect src = GetTextureSrcRect(anim->frames[frame]);
+		SDL_Rect dest = GetTextureSrcRect(anim->tile_index);
+		CopyIndexedRect(&indexed, get_slot_rect(src), dest.x - 1, dest.y - 1);
+
+		// the slot now has the frame's pixels, and so the frame's colors
+		SDL_memcpy(&tile_colors[anim->tile_index * 4], &tile_colors[anim->frames[frame] * 4], 4 * sizeof(*tile_colors));
+		mark_changed(anim->tile_index);
+	}
+
+	UpdateIndexedImage(&indexed);
+
+	// exactly the tiles whose slots use a color that changed
+	const uint64_t* changed = indexed.changed;
+	if (changed[0] || changed[1] || changed[2] || changed[3]) {
+		for (int i = 0; i < tile_count; i++) {
+			const uint64_t* colors = &tile_colors[i * 4];
+			if ((colors[0] & changed[0]) || (colors[1] & changed[1])
+				|| (colors[2] & changed[2]) || (colors[3] & changed[3])) {
+				mark_changed(i);
+			}
+		}
+	}
+
+	return changed_tile_count > 0;
+}
+
+void TileSet::AllocateProfiles(int profile_count, int tile_count) {
+	if (profile_records_memory) free(profile_records_memory);
+	if (tile_profiles) free(tile_profiles);
+	if (profile_angles) free(profile_angles);
+	if (profile_widths) free(profile_widths);
+	if (profile_heights) free(profile_heights);
+
+	this->profile_count = profile_count;
+	this->tile_count = tile_count;
+
+	profile_heights = (uint8_t*) ecalloc(max(profile_count, 1), 16 * sizeof(*profile_heights));
+	profile_widths  = (uint8_t*) ecalloc(max(profile_count, 1), 16 * sizeof(*profile_widths));
+	profile_angles  = (float*)   ecalloc(max(profile_count, 1), sizeof(*profile_angles));
+	tile_profiles   = (uint8_t*) ecalloc(max(tile_count, 1), sizeof(*tile_profiles));
+
+	// ecalloc doesn't align to a cache line, so take one record extra
+	profile_records_memory = ecalloc(max(profile_count, 1) + 1, sizeof(TileCollision));
+	uintptr_t address = ((uintptr_t) profile_records_memory + alignof(TileCollision) - 1) & ~(uintptr_t) (alignof(TileCollision) - 1);
+	profile_records = (TileCollision*) address;
+
+	UpdateProfileRecords();
+}
+
+void TileSet::UpdateProfileRecords() {
+	for (int profile = 0; profile < profile_count; profile++) {
+		TileCollision* record = &profile_records[profile];
+		*record = {};
+
+		SDL_memcpy(record->heights, &profile_heights[profile * 16], 16);
+		SDL_memcpy(record->widths,  &profile_widths [profile * 16], 16);
+		record->angle = profile_angles[profile];
+
+		if (record->angle == -1.0f) {
+			record->flags |= TILE_COLLISION_FLAGGED;
+		}
+	}
+}
+
+bool TileSet::SetProfilesFromTiles(const uint8_t* heights, const uint8_t* widths, const float* angles, int tile_count) {
+	AllocateProfiles(TILESET_MAX_PROFILES, tile_count);
+
+	bool result = true;
+	int count = 0;
+
+	for (int tile_index = 0; tile_index < tile_count; tile_index++) {
+		const uint8_t* height = &heights[tile_index * 16];
+		const uint8_t* width  = &widths[tile_index * 16];
+		float angle = angles[tile_index];
+
+		int profile = 0;
+		for (; profile < count; profile++) {
+			if (SDL_memcmp(&profile_heights[profile * 16], height, 16) == 0
+				&& SDL_memcmp(&profile_widths[profile * 16], width, 16) == 0
+				&& profile_angles[profile] == angle) {
+				break;
+			}
+		}
+
+		if (profile == count) {
+			if (count == TILESET_MAX_PROFILES) {
+				SDL_Log("Tile %d has a new collision shape, but all %d profiles are taken.", tile_index, TILESET_MAX_PROFILES);
+				result = false;
+				tile_profiles[tile_index] = 0;
+				continue;
+			}
+
+			SDL_memcpy(&profile_heights[count * 16], height, 16);
+			SDL_memcpy(&profile_widths [count * 16], width,  16);
+			profile_angles[count] = angle;
+			count++;
+		}
+
+		tile_profiles[tile_index] = (uint8_t) profile;
+	}
+
+	profile_count = max(count, 1);
+	UpdateProfileRecords();
+	return result;
+}
+
+void TileSet::SetGridSrcRects(int tiles_in_row, int padding) {
+	if (src_rects) free(src_rects);
+	src_rects = (SDL_Rect*) ecalloc(max(tile_count, 1), sizeof(*src_rects));
+
+	tiles_in_row = max(tiles_in_row, 1);
+	int slot_size = 16 + 2 * padding;
+
+	for (int tile_index = 0; tile_index < tile_count; tile_index++) {
+		int tile_x = tile_index % tiles_in_row;
+		int tile_y = tile_index / tiles_in_row;
+
+		src_rects[tile_index] = {padding + tile_x * slot_size, padding + tile_y * slot_size, 16, 16};
 	}
 }
 
 void TileSet::Destroy() {
-	if (width_texture) SDL_DestroyTexture(width_texture);
-	width_texture = nullptr;
+	DestroyCollisionTextures();
 
-	if (height_texture) SDL_DestroyTexture(height_texture);
-	height_texture = nullptr;
+	if (src_rects) free(src_rects);
+	src_rects = nullptr;
 
-	if (texture) SDL_DestroyTexture(texture);
+	// the editor may have replaced the texture
+	if (texture && texture != indexed.texture) SDL_DestroyTexture(texture);
 	texture = nullptr;
 
-	if (tile_angles) free(tile_angles);
-	tile_angles = nullptr;
+	DestroyIndexedImage(&indexed);
+
+	if (tile_anims) free(tile_anims);
+	tile_anims = nullptr;
+	tile_anim_count = 0;
+
+	if (changed_tiles) free(changed_tiles);
+	changed_tiles = nullptr;
+	changed_tile_count = 0;
+
+	if (tile_graphics) free(tile_graphics);
+	tile_graphics = nullptr;
+
+	if (tile_colors) free(tile_colors);
+	tile_colors = nullptr;
+
+	if (surface) SDL_FreeSurface(surface);
+	surface = nullptr;
+
+	if (profile_records_memory) free(profile_records_memory);
+	profile_records_memory = nullptr;
+	profile_records = nullptr;
+
+	if (tile_profiles) free(tile_profiles);
+	tile_profiles = nullptr;
+
+	if (profile_angles) free(profile_angles);
+	profile_angles = nullptr;
+
+	if (profile_widths) free(profile_widths);
+	profile_widths = nullptr;
 
-	if (tile_widths) free(tile_widths);
-	tile_widths = nullptr;
+	if (profile_heights) free(profile_heights);
+	profile_heights = nullptr;
 
-	if (tile_heights) free(tile_heights);
-	tile_heights = nullptr;
+	profile_count = 0;
 }
 
-void TileSet::GenCollisionTextures() {
-	int texture_w;
-	int texture_h;
-	SDL_QueryTexture(texture, nullptr, nullptr, &texture_w, &texture_h);
+struct CollisionTexturesJob {
+	TileSet* tileset;
+	SDL_Surface* surf;
+	SDL_Surface* wsurf;
+	int first_tile;
+	int end_tile;
+};
 
-	SDL_Surface* surf = SDL_CreateRGBSurfaceWithFormat(0, texture_w, texture_h, 32, SDL_PIXELFORMAT_ARGB8888);
-	SDL_FillRect(surf, nullptr, 0x00000000);
-	SDL_Surface* wsurf = SDL_CreateRGBSurfaceWithFormat(0, texture_w, texture_h, 32, SDL_PIXELFORMAT_ARGB8888);
-	SDL_FillRect(wsurf, nullptr, 0x00000000);
+// Every tile only touches its own 16x16 area, so jobs never overlap.
+static int gen_collision_textures_job(void* userdata) {
+	CollisionTexturesJob* job = (CollisionTexturesJob*) userdata;
+	TileSet* tileset = job->tileset;
+
+	int pitch  = job->surf->pitch  / 4;
+	int wpitch = job->wsurf->pitch / 4;
+
+	for (int tile_index = job->first_tile; tile_index < job->end_tile; tile_index++) {
+		uint8_t* height = tileset->GetTileHeight(tile_index);
+		uint8_t* width  = tileset->GetTileWidth(tile_index);
+		SDL_Rect src = tileset->GetCollisionSrcRect(tile_index);
+
+		uint32_t* pixels  = (uint32_t*) job->surf->pixels  + src.x + src.y * pitch;
+		uint32_t* wpixels = (uint32_t*) job->wsurf->pixels + src.x + src.y * wpitch;
 
-	for (int tile_index = 0; tile_index < tile_count; tile_index++) {
-		uint8_t* height = GetTileHeight(tile_index);
-		uint8_t* width  = GetTileWidth(tile_index);
-		SDL_Rect src = GetTextureSrcRect(tile_index);
 		for (int i = 0; i < 16; i++) {
 			if (height[i] != 0) {
 				if (height[i] <= 0x10) {
-					SDL_Rect line = {
-						src.x + i,
-						src.y + 16 - height[i],
-						1,
-						height[i]
-					};
-					SDL_FillRect(surf, &line, 0xffffffff);
+					for (int y = 16 - height[i]; y < 16; y++) {
+						pixels[i + y * pitch] = 0xffffffff;
+					}
 				} else if (height[i] >= 0xF0) {
-					SDL_Rect line = {
-						src.x + i,
-						src.y,
-						1,
-						16 - (height[i] - 0xF0)
-					};
-					SDL_FillRect(surf, &line, 0xffff0000);
+					for (int y = 0; y < 16 - (height[i] - 0xF0); y++) {
+						pixels[i + y * pitch] = 0xffff0000;
+					}
 				}
 			}
 
 			if (width[i] != 0) {
+				uint32_t* row = wpixels + i * wpitch;
 				if (width[i] <= 0x10) {
-					SDL_Rect line = {
-						src.x + 16 - width[i],
-						src.y + i,
-						width[i],
-						1
-					};
-					SDL_FillRect(wsurf, &line, 0xffffffff);
-				} else {
-					SDL_Rect line = {
-						src.x,
-						src.y + i,
-						16 - (width[i] - 0xF0),
-						1
-					};
-					SDL_FillRect(wsurf, &line, 0xffff0000);
+					for (int x = 16 - width[i]; x < 16; x++) {
+						row[x] = 0xffffffff;
+					}
+				} else if (width[i] >= 0xF0) {
+					for (int x = 0; x < 16 - (width[i] - 0xF0); x++) {
+						row[x] = 0xffff0000;
+					}
 				}
 			}
 		}
 	}
 
+	return 0;
+}
+
+#define MAX_COLLISION_TEXTURES_JOBS 8
+#define MIN_TILES_PER_JOB 64
+
+void TileSet::GenCollisionTextures() {
+	DestroyCollisionTextures();
+
+	// one slot per tile index: tiles that share pixels in the atlas can still differ in collision
+	int texture_w = 16 * 16;
+	int texture_h = max((tile_count + 15) / 16, 1) * 16;
+
+	// new surfaces are cleared
+	SDL_Surface* surf = SDL_CreateRGBSurfaceWithFormat(0, texture_w, texture_h, 32, SDL_PIXELFORMAT_ARGB8888);
+	SDL_Surface* wsurf = SDL_CreateRGBSurfaceWithFormat(0, texture_w, texture_h, 32, SDL_PIXELFORMAT_ARGB8888);
+
+	if (!surf || !wsurf) {
+		if (surf) SDL_FreeSurface(surf);
+		if (wsurf) SDL_FreeSurface(wsurf);
+		return;
+	}
+
+	int job_count = min(min(SDL_GetCPUCount(), MAX_COLLISION_TEXTURES_JOBS), tile_count / MIN_TILES_PER_JOB);
+	job_count = max(job_count, 1);
+
+	CollisionTexturesJob jobs[MAX_COLLISION_TEXTURES_JOBS];
+	SDL_Thread* threads[MAX_COLLISION_TEXTURES_JOBS] = {};
+
+	for (int i = 0; i < job_count; i++) {
+		jobs[i].tileset = this;
+		jobs[i].surf = surf;
+		jobs[i].wsurf = wsurf;
+		jobs[i].first_tile = tile_count * i / job_count;
+		jobs[i].end_tile = tile_count * (i + 1) / job_count;
+	}
+
+	// the first job runs here
+	for (int i = 1; i < job_count; i++) {
+		threads[i] = SDL_CreateThread(gen_collision_textures_job, "collision textures", &jobs[i]);
+	}
+
+	gen_collision_textures_job(&jobs[0]);
+
+	for (int i = 1; i < job_count; i++) {
+		if (threads[i]) {
+			SDL_WaitThread(threads[i], nullptr);
+		} else {
+			gen_collision_textures_job(&jobs[i]);
+		}
+	}
+
 	height_texture = SDL_CreateTextureFromSurface(game->renderer, surf);
 	width_texture = SDL_CreateTextureFromSurface(game->renderer, wsurf);
 
 	SDL_FreeSurface(surf);
 	SDL_FreeSurface(wsurf);
 }
+
+void TileSet::DestroyCollisionTextures() {
+	if (width_texture) SDL_DestroyTexture(width_texture);
+	width_texture = nullptr;
+
+	if (height_texture) SDL_DestroyTexture(height_texture);
+	height_texture = nullptr;
+}
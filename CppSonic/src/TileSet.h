@@ -3,58 +3,213 @@
 #include <SDL.h>
 #include <stdint.h>
 
+#include "IndexedImage.h"
+
+// Tileset files with a shared profile table start with this (after the LZ4 magic).
+#define TILESET_PROFILES_MAGIC int(0xC5505246)
+
+// A profile index is one byte.
+#define TILESET_MAX_PROFILES 256
+
+#define TILESET_MAX_ANIM_FRAMES 16
+
+// A tile and its 1 pixel padding, in the grid and in atlases alike.
+#define TILESET_SLOT_SIZE 18
+
+enum {
+	TILE_COLLISION_FLAGGED = 1, // no angle, the player takes the angle of its mode
+};
+
+enum {
+	TILE_GRAPHICS_LIVE    = 1, // animated or uses a cycled color
+	TILE_GRAPHICS_CHANGED = 2, // by the last UpdateGraphics
+};
+
+// Everything a sensor reads about a profile, in one cache line.
+struct alignas(64) TileCollision {
+	uint8_t heights[16];
+	uint8_t widths[16];
+	float angle;
+	uint32_t flags;
+	uint8_t padding[24];
+};
+
+static_assert(sizeof(TileCollision) == 64, "TileCollision should be one cache line");
+
+enum struct TileCollisionLayout {
+	INTERLEAVED, // read profile_records
+	SPLIT        // read profile_heights, profile_widths and profile_angles
+};
+
+// Every frames_per_step frames, the next frame's graphics are copied over the
+// tile in the texture. Every instance of the tile changes with it.
+struct TileAnim {
+	int tile_index;
+	int frames[TILESET_MAX_ANIM_FRAMES]; // tiles the graphics come from
+	int frame_count;
+	int frames_per_step;
+	int timer;
+	int frame;
+};
+
 struct TileSet {
-	uint8_t* tile_heights;
-	uint8_t* tile_widths;
-	float* tile_angles;
+	// Collision shapes are shared between tiles, like the collision array in
+	// S1. A tile only stores which profile it uses, so all of the collision
+	// data stays small however many tiles there are.
+	uint8_t* profile_heights; // 16 per profile
+	uint8_t* profile_widths;  // 16 per profile
+	float* profile_angles;
+	int profile_count;
+
+	uint8_t* tile_profiles;
+
+	// The same profiles interleaved. Rebuilt by UpdateProfileRecords whenever
+	// the arrays above change.
+	TileCollision* profile_records;
+	void* profile_records_memory;
+	TileCollisionLayout collision_layout;
 
 	int tile_count;
-	int tiles_in_row = 16;
 	uint8_t height_stub[16];
 
+	// Where every tile is in the texture. Tilesets exported with an atlas store
+	// this table, older ones are assumed to be a grid of 18x18 padded slots.
+	SDL_Rect* src_rects;
+
 	SDL_Texture* texture;
+	SDL_Surface* surface; // ARGB8888, only kept for the software renderer
+
+	// The 8-bit pixels behind texture, if the tileset has at most 256 colors.
+	// Needed for palette cycles and tile animations, and released without them.
+	IndexedImage indexed;
+
+	TileAnim* tile_anims;
+	int tile_anim_count;
+
+	// Per tile, the palette entries its slot uses (4 x 64 bits) and
+	// TILE_GRAPHICS_* flags. Only there if indexed is.
+	uint64_t* tile_colors;
+	uint8_t* tile_graphics;
+	int* changed_tiles; // by the last UpdateGraphics
+	int changed_tile_count;
+
 	SDL_Texture* height_texture;
 	SDL_Texture* width_texture;
 
-	void LoadFromFile(const char* binary_filepath, const char* texture_filepath);
+	// Returns false if the tileset couldn't be loaded, or its collision
+	// doesn't fit in the profile table.
+	bool LoadFromFile(const char* binary_filepath, const char* texture_filepath);
 	void Destroy();
 
+	// Optional text file, one cycle per line: frames per step, then the
+	// colors in hex (RRGGBB) in the order they rotate through.
+	void LoadPaletteCycles(const char* fname);
+
+	// Optional text file, one animated tile per line: frames per step, the
+	// tile, then the tiles it takes its graphics from in turn.
+	void LoadTileAnims(const char* fname);
+
+	// Call once per frame. Returns true if any tile's graphics changed, the
+	// tiles in changed_tiles have to be drawn again then.
+	bool UpdateGraphics();
+
+	// Only live tiles ever change, so they're the only ones worth tracking.
+	bool IsTileLive(int tile_index) {
+		return tile_graphics && tile_index < tile_count && (tile_graphics[tile_index] & TILE_GRAPHICS_LIVE);
+	}
+
+	bool IsTileChanged(int tile_index) {
+		return tile_graphics && tile_index < tile_count && (tile_graphics[tile_index] & TILE_GRAPHICS_CHANGED);
+	}
+
+	// Finds the live tiles again, after cycles or animations were added or
+	// the tiles were renumbered.
+	void UpdateLiveTiles();
+
+	// Call after loading the cycles and animations. If no tile is live, the
+	// 8-bit pixels are freed and only the texture is kept.
+	void ReleaseStaticGraphics();
+
+	// Fills src_rects for tiles laid out in rows, each in a slot of
+	// 16 + 2 * padding pixels.
+	void SetGridSrcRects(int tiles_in_row, int padding);
+
+	// Allocates the profile table and the per-tile indices, all zeroed.
+	void AllocateProfiles(int profile_count, int tile_count);
+	void UpdateProfileRecords();
+
+	// Fills the profile table from per-tile arrays, merging tiles with the same
+	// shape. Returns false and logs the tiles left over if there are more than
+	// TILESET_MAX_PROFILES shapes.
+	bool SetProfilesFromTiles(const uint8_t* heights, const uint8_t* widths, const float* angles, int tile_count);
+
 	uint8_t* GetTileHeight(int tile_index) {
 		if (tile_index < tile_count) {
-			return &tile_heights[tile_index * 16];
+			int profile = tile_profiles[tile_index];
+			if (collision_layout == TileCollisionLayout::INTERLEAVED) {
+				return profile_records[profile].heights;
+			}
+			return &profile_heights[profile * 16];
 		}
 		return height_stub;
 	}
 
 	uint8_t* GetTileWidth(int tile_index) {
 		if (tile_index < tile_count) {
-			return &tile_widths[tile_index * 16];
+			int profile = tile_profiles[tile_index];
+			if (collision_layout == TileCollisionLayout::INTERLEAVED) {
+				return profile_records[profile].widths;
+			}
+			return &profile_widths[profile * 16];
 		}
 		return height_stub;
 	}
 
 	float GetTileAngle(int tile_index) {
 		if (tile_index < tile_count) {
-			return tile_angles[tile_index];
+			int profile = tile_profiles[tile_index];
+			if (collision_layout == TileCollisionLayout::INTERLEAVED) {
+				return profile_records[profile].angle;
+			}
+			return profile_angles[profile];
 		}
 		return 0.0f;
 	}
 
-	SDL_Rect GetTextureSrcRect(int tile_index) {
+	uint32_t GetTileFlags(int tile_index) {
 		if (tile_index < tile_count) {
-			int tile_x = tile_index % tiles_in_row;
-			int tile_y = tile_index / tiles_in_row;
-
-			// int u = tile_x * 16;
-			// int v = tile_y * 16;
+			int profile = tile_profiles[tile_index];
+			if (collision_layout == TileCollisionLayout::INTERLEAVED) {
+				return profile_records[profile].flags;
+			}
+			return (profile_angles[profile] == -1.0f) ? TILE_COLLISION_FLAGGED : 0;
+		}
+		return 0;
+	}
 
-			int u = 1 + tile_x * 18;
-			int v = 1 + tile_y * 18;
+	SDL_Rect GetTextureSrcRect(int tile_index) {
+		if (tile_index < tile_count && src_rects) {
+			return src_rects[tile_index];
+		}
+		return {0, 0, 16, 16};
+	}
 
-			return {u, v, 16, 16};
+	// The collision textures are a plain grid, 16 tiles wide.
+	SDL_Rect GetCollisionSrcRect(int tile_index) {
+		if (tile_index < tile_count) {
+			return {(tile_index % 16) * 16, (tile_index / 16) * 16, 16, 16};
 		}
 		return {0, 0, 16, 16};
 	}
 
+	// The height and width debug textures. Nothing needs them until a
+	// collision overlay is shown, so they're only made on request.
 	void GenCollisionTextures();
+	void DestroyCollisionTextures();
+
+	void RequestCollisionTextures() {
+		if (!height_texture && tile_count > 0) {
+			GenCollisionTextures();
+		}
+	}
 };
@@ -0,0 +1,59 @@
+#include "TileUsers.h"
+
+#include "misc.h"
+#include "mathh.h"
+
+void BuildTileUsers(TileUsers* users, TileMap* tilemap, TileSet* tileset) {
+	DestroyTileUsers(users);
+
+	users->tile_count = tileset->tile_count;
+	users->first = (int*) ecalloc(users->tile_count + 1, sizeof(*users->first));
+
+	if (tilemap->regions || !tileset->tile_graphics) {
+		return;
+	}
+
+	// count the uses of every tile, then turn the counts into offsets
+	for (int layer = 0; layer < tilemap->layer_count; layer++) {
+		for (int y = 0; y < tilemap->height; y++) {
+			for (int x = 0; x < tilemap->width; x++) {
+				Tile tile = tilemap->GetTileGraphicUnchecked(x, y, layer);
+				if (tileset->IsTileLive(tile.index)) {
+					users->first[tile.index + 1]++;
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < users->tile_count; i++) {
+		users->first[i + 1] += users->first[i];
+	}
+
+	users->use_count = users->first[users->tile_count];
+	users->uses = (TileUse*) ecalloc(max(users->use_count, 1), sizeof(*users->uses));
+
+	int* next = (int*) ecalloc(max(users->tile_count, 1), sizeof(*next));
+	SDL_memcpy(next, users->first, users->tile_count * sizeof(*next));
+
+	for (int layer = 0; layer < tilemap->layer_count; layer++) {
+		for (int y = 0; y < tilemap->height; y++) {
+			for (int x = 0; x < tilemap->width; x++) {
+				Tile tile = tilemap->GetTileGraphicUnchecked(x, y, layer);
+				if (tileset->IsTileLive(tile.index)) {
+					TileUse* use = &users->uses[next[tile.index]++];
+					use->x = (uint16_t) x;
+					use->y = (uint16_t) y;
+					use->layer = (uint8_t) layer;
+				}
+			}
+		}
+	}
+
+	free(next);
+}
+
+void DestroyTileUsers(TileUsers* users) {
+	if (users->uses) free(users->uses);
+	if (users->first) free(users->first);
+	*users = {};
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "TileSet.h"
+#include "TileMap.h"
+
+struct TileUse {
+	uint16_t x;
+	uint16_t y;
+	uint8_t layer;
+};
+
+// Every map cell that holds a live tile (see TileSet::IsTileLive), grouped
+// by tile, so when a tile's graphics change only the cells that show it are
+// drawn again, without looking at the rest of the map. The uses of tile i
+// are uses[first[i]] up to uses[first[i + 1]].
+struct TileUsers {
+	int* first; // tile_count + 1
+	TileUse* uses;
+	int tile_count;
+	int use_count;
+};
+
+// Build again after the tilemap or the live tiles change. Maps split into
+// regions aren't resident, nothing is indexed for them.
+void BuildTileUsers(TileUsers* users, TileMap* tilemap, TileSet* tileset);
+void DestroyTileUsers(TileUsers* users);
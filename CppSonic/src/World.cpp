@@ -4,6 +4,8 @@
 #include "mathh.h"
 #include "stb_sprintf.h"
 #include "misc.h"
+#include "Compression.h"
+#include "PerfCounters.h"
 
 #include <SDL_image.h>
 
@@ -37,6 +39,12 @@ void World::load_objects(const char* fname) {
 		int object_count;
 		SDL_RWread(f, &object_count, sizeof(object_count), 1);
 
+		bool compressed = false;
+		if (object_count == LZ4_LEVEL_MAGIC) {
+			compressed = true;
+			SDL_RWread(f, &object_count, sizeof(object_count), 1);
+		}
+
 		if (object_count < 0 || object_count >= MAX_OBJECTS) {
 			ErrorMessageBox("Invalid objects file.");
 			goto out;
@@ -44,7 +52,13 @@ void World::load_objects(const char* fname) {
 
 		this->object_count = object_count;
 
-		SDL_RWread(f, objects, sizeof(*objects), object_count);
+		if (compressed) {
+			if (!LZ4ReadSection(f, objects, object_count * sizeof(*objects))) {
+				ErrorMessageBox("Objects data is corrupted.");
+			}
+		} else {
+			SDL_RWread(f, objects, sizeof(*objects), object_count);
+		}
 
 		for (int i = 0; i < object_count; i++) {
 			objects[i].id = next_id++;
@@ -61,20 +75,35 @@ void World::Init() {
 	target_w = GAME_W;
 	target_h = GAME_H;
 
+	plane_renderer.Init();
+	chunk_cache.Init();
+	tile_batch.Init();
+	draw_list.Init();
+
 	Player* p = &player;
 
 #ifdef EDITOR
 	tileset.LoadFromFile("levels/export/tileset.bin",
 						 "levels/export/tileset_padded.png");
-	tilemap.LoadFromFile("levels/export/tilemap.bin");
+	tilemap.LoadFromFile("levels/export/tilemap.bin", game->tile_layout);
 	load_objects("levels/export/objects.bin");
 #else
-	tileset.LoadFromFile("levels/GHZ1/tileset.bin",
-						 "levels/GHZ1/tileset_padded.png");
-	tilemap.LoadFromFile("levels/GHZ1/tilemap.bin");
+	if (!tileset.LoadFromFile("levels/GHZ1/tileset.bin",
+							  "levels/GHZ1/tileset_padded.png")) {
+		exit(1);
+	}
+	tileset.LoadPaletteCycles("levels/GHZ1/palette_cycles.txt");
+	tileset.LoadTileAnims("levels/GHZ1/tile_anims.txt");
+	tilemap.LoadFromFile("levels/GHZ1/tilemap.bin", game->tile_layout);
 	load_objects("levels/GHZ1/objects.bin");
+	background.Load("levels/GHZ1/background.png", "levels/GHZ1/background.txt", target_w);
 #endif
 
+	tileset.collision_layout = game->collision_layout;
+
+	tileset.ReleaseStaticGraphics();
+	BuildTileUsers(&tile_users, &tilemap, &tileset);
+
 	p->x = tilemap.start_x;
 	p->y = tilemap.start_y;
 
@@ -83,13 +112,43 @@ void World::Init() {
 
 	p->anim = anim_idle;
 	p->next_anim = anim_idle;
+
+	sensor_trace.recording = game->bench_sensors;
 }
 
 void World::Quit() {
+	if (sensor_trace.queries) free(sensor_trace.queries);
+	sensor_trace = {};
+
+	background.Destroy();
+	DestroyTileUsers(&tile_users);
+	draw_list.Destroy();
+	tile_batch.Destroy();
+	chunk_cache.Destroy();
+	plane_renderer.Destroy();
 	tilemap.Destroy();
 	tileset.Destroy();
 }
 
+static void record_sensor_query(SensorTrace* trace, float x, float y, int layer, int direction) {
+	if (trace->count == trace->capacity) {
+		int capacity = max(trace->capacity * 2, 4096);
+		SensorQuery* queries = (SensorQuery*) ecalloc(capacity, sizeof(*queries));
+		if (trace->queries) {
+			SDL_memcpy(queries, trace->queries, trace->count * sizeof(*queries));
+			free(trace->queries);
+		}
+		trace->queries = queries;
+		trace->capacity = capacity;
+	}
+
+	SensorQuery* q = &trace->queries[trace->count++];
+	q->x = x;
+	q->y = y;
+	q->layer = uint8_t(layer);
+	q->direction = uint8_t(direction);
+}
+
 static bool player_is_grounded(Player* p) {
 	return (p->state == PlayerState::GROUND
 			|| p->state == PlayerState::ROLL);
@@ -206,6 +265,10 @@ void World::GetPushSensorsPositions(Player* p, float* sensor_e_x, float* sensor_
 SensorResult World::SensorCheckDown(float x, float y, int layer) {
 	SensorResult result = {};
 
+	if (sensor_trace.recording) {
+		record_sensor_query(&sensor_trace, x, y, layer, SENSOR_DOWN);
+	}
+
 	auto _get_height = [this](Tile tile, int ix, int iy) {
 		if (!tile.top_solid) {
 			return 0;
@@ -232,6 +295,12 @@ SensorResult World::SensorCheckDown(float x, float y, int layer) {
 		return height;
 	};
 
+	// the lookups below don't check the layer
+	if (layer < 0 || layer >= tilemap.layer_count) {
+		result.dist = 32;
+		return result;
+	}
+
 	int ix = (int) x;
 	int iy = (int) y;
 
@@ -248,37 +317,36 @@ SensorResult World::SensorCheckDown(float x, float y, int layer) {
 		return result;
 	}
 
-	Tile tile = tilemap.GetTile(tile_x, tile_y, layer);
+	Tile tile = tilemap.GetTileUnchecked(tile_x, tile_y, layer);
 	int height = _get_height(tile, ix, iy);
 
 	if (height == 0) {
-		if (tile_y + 1 < tilemap.height) {
-			tile_y++;
-			tile = tilemap.GetTile(tile_x, tile_y, layer);
-			height = _get_height(tile, ix, iy);
-
+		// past the edge of the map this reads an empty border tile
+		bool in_map = (tile_y + 1 < tilemap.height);
+		tile_y++;
+		tile = tilemap.GetTileUnchecked(tile_x, tile_y, layer);
+		height = _get_height(tile, ix, iy);
+
+		result.found = in_map;
+		if (in_map) {
 			result.tile = tile;
-			result.found = true;
 			result.tile_x = tile_x;
 			result.tile_y = tile_y;
-		} else {
-			height = 0;
 		}
 
 		result.dist = (32 - (iy % 16)) - (height + 1);
 		return result;
 	} else if (height == 16) {
-		if (tile_y - 1 >= 0) {
-			tile_y--;
-			tile = tilemap.GetTile(tile_x, tile_y, layer);
-			height = _get_height(tile, ix, iy);
+		bool in_map = (tile_y - 1 >= 0);
+		tile_y--;
+		tile = tilemap.GetTileUnchecked(tile_x, tile_y, layer);
+		height = _get_height(tile, ix, iy);
 
+		result.found = in_map;
+		if (in_map) {
 			result.tile = tile;
-			result.found = true;
 			result.tile_x = tile_x;
 			result.tile_y = tile_y;
-		} else {
-			height = 0;
 		}
 
 		result.dist = -(iy % 16) - (height + 1);
@@ -299,6 +367,10 @@ SensorResult World::SensorCheckDown(float x, float y, int layer) {
 SensorResult World::SensorCheckRight(float x, float y, int layer) {
 	SensorResult result = {};
 
+	if (sensor_trace.recording) {
+		record_sensor_query(&sensor_trace, x, y, layer, SENSOR_RIGHT);
+	}
+
 	auto _get_height = [this](Tile tile, int ix, int iy) {
 		if (!tile.left_right_bottom_solid) {
 			return 0;
@@ -325,6 +397,12 @@ SensorResult World::SensorCheckRight(float x, float y, int layer) {
 		return height;
 	};
 
+	// the lookups below don't check the layer
+	if (layer < 0 || layer >= tilemap.layer_count) {
+		result.dist = 32;
+		return result;
+	}
+
 	int ix = (int) x;
 	int iy = (int) y;
 
@@ -341,37 +419,35 @@ SensorResult World::SensorCheckRight(float x, float y, int layer) {
 		return result;
 	}
 
-	Tile tile = tilemap.GetTile(tile_x, tile_y, layer);
+	Tile tile = tilemap.GetTileUnchecked(tile_x, tile_y, layer);
 	int height = _get_height(tile, ix, iy);
 
 	if (height == 0) {
-		if (tile_x + 1 < tilemap.width) {
-			tile_x++;
-			tile = tilemap.GetTile(tile_x, tile_y, layer);
-			height = _get_height(tile, ix, iy);
+		bool in_map = (tile_x + 1 < tilemap.width);
+		tile_x++;
+		tile = tilemap.GetTileUnchecked(tile_x, tile_y, layer);
+		height = _get_height(tile, ix, iy);
 
+		result.found = in_map;
+		if (in_map) {
 			result.tile = tile;
-			result.found = true;
 			result.tile_x = tile_x;
 			result.tile_y = tile_y;
-		} else {
-			height = 0;
 		}
 
 		result.dist = (32 - (ix % 16)) - (height + 1);
 		return result;
 	} else if (height == 16) {
-		if (tile_x - 1 >= 0) {
-			tile_x--;
-			tile = tilemap.GetTile(tile_x, tile_y, layer);
-			height = _get_height(tile, ix, iy);
+		bool in_map = (tile_x - 1 >= 0);
+		tile_x--;
+		tile = tilemap.GetTileUnchecked(tile_x, tile_y, layer);
+		height = _get_height(tile, ix, iy);
 
+		result.found = in_map;
+		if (in_map) {
 			result.tile = tile;
-			result.found = true;
 			result.tile_x = tile_x;
 			result.tile_y = tile_y;
-		} else {
-			height = 0;
 		}
 
 		result.dist = -(ix % 16) - (height + 1);
@@ -392,6 +468,10 @@ SensorResult World::SensorCheckRight(float x, float y, int layer) {
 SensorResult World::SensorCheckUp(float x, float y, int layer) {
 	SensorResult result = {};
 
+	if (sensor_trace.recording) {
+		record_sensor_query(&sensor_trace, x, y, layer, SENSOR_UP);
+	}
+
 	auto _get_height = [this](Tile tile, int ix, int iy) {
 		if (!tile.left_right_bottom_solid) {
 			return 0;
@@ -418,6 +498,12 @@ SensorResult World::SensorCheckUp(float x, float y, int layer) {
 		return height;
 	};
 
+	// the lookups below don't check the layer
+	if (layer < 0 || layer >= tilemap.layer_count) {
+		result.dist = 32;
+		return result;
+	}
+
 	int ix = (int) x;
 	int iy = (int) y;
 
@@ -434,37 +520,35 @@ SensorResult World::SensorCheckUp(float x, float y, int layer) {
 		return result;
 	}
 
-	Tile tile = tilemap.GetTile(tile_x, tile_y, layer);
+	Tile tile = tilemap.GetTileUnchecked(tile_x, tile_y, layer);
 	int height = _get_height(tile, ix, iy);
 
 	if (height == 0) {
-		if (tile_y - 1 >= 0) {
-			tile_y--;
-			tile = tilemap.GetTile(tile_x, tile_y, layer);
-			height = _get_height(tile, ix, iy);
+		bool in_map = (tile_y - 1 >= 0);
+		tile_y--;
+		tile = tilemap.GetTileUnchecked(tile_x, tile_y, layer);
+		height = _get_height(tile, ix, iy);
 
+		result.found = in_map;
+		if (in_map) {
 			result.tile = tile;
-			result.found = true;
 			result.tile_x = tile_x;
 			result.tile_y = tile_y;
-		} else {
-			height = 0;
 		}
 
 		result.dist = 16 + (iy % 16) - (height);
 		return result;
 	} else if (height == 16) {
-		if (tile_y + 1 < tilemap.height) {
-			tile_y++;
-			tile = tilemap.GetTile(tile_x, tile_y, layer);
-			height = _get_height(tile, ix, iy);
+		bool in_map = (tile_y + 1 < tilemap.height);
+		tile_y++;
+		tile = tilemap.GetTileUnchecked(tile_x, tile_y, layer);
+		height = _get_height(tile, ix, iy);
 
+		result.found = in_map;
+		if (in_map) {
 			result.tile = tile;
-			result.found = true;
 			result.tile_x = tile_x;
 			result.tile_y = tile_y;
-		} else {
-			height = 0;
 		}
 
 		result.dist = -16 + (iy % 16) - (height);
@@ -485,6 +569,10 @@ SensorResult World::SensorCheckUp(float x, float y, int layer) {
 SensorResult World::SensorCheckLeft(float x, float y, int layer) {
 	SensorResult result = {};
 
+	if (sensor_trace.recording) {
+		record_sensor_query(&sensor_trace, x, y, layer, SENSOR_LEFT);
+	}
+
 	auto _get_height = [this](Tile tile, int ix, int iy) {
 		if (!tile.left_right_bottom_solid) {
 			return 0;
@@ -511,6 +599,12 @@ SensorResult World::SensorCheckLeft(float x, float y, int layer) {
 		return height;
 	};
 
+	// the lookups below don't check the layer
+	if (layer < 0 || layer >= tilemap.layer_count) {
+		result.dist = 32;
+		return result;
+	}
+
 	int ix = (int) x;
 	int iy = (int) y;
 
@@ -527,37 +621,35 @@ SensorResult World::SensorCheckLeft(float x, float y, int layer) {
 		return result;
 	}
 
-	Tile tile = tilemap.GetTile(tile_x, tile_y, layer);
+	Tile tile = tilemap.GetTileUnchecked(tile_x, tile_y, layer);
 	int height = _get_height(tile, ix, iy);
 
 	if (height == 0) {
-		if (tile_x - 1 >= 0) {
-			tile_x--;
-			tile = tilemap.GetTile(tile_x, tile_y, layer);
-			height = _get_height(tile, ix, iy);
+		bool in_map = (tile_x - 1 >= 0);
+		tile_x--;
+		tile = tilemap.GetTileUnchecked(tile_x, tile_y, layer);
+		height = _get_height(tile, ix, iy);
 
+		result.found = in_map;
+		if (in_map) {
 			result.tile = tile;
-			result.found = true;
 			result.tile_x = tile_x;
 			result.tile_y = tile_y;
-		} else {
-			height = 0;
 		}
 
 		result.dist = 16 + (ix % 16) - (height);
 		return result;
 	} else if (height == 16) {
-		if (tile_x + 1 < tilemap.width) {
-			tile_x++;
-			tile = tilemap.GetTile(tile_x, tile_y, layer);
-			height = _get_height(tile, ix, iy);
+		bool in_map = (tile_x + 1 < tilemap.width);
+		tile_x++;
+		tile = tilemap.GetTileUnchecked(tile_x, tile_y, layer);
+		height = _get_height(tile, ix, iy);
 
+		result.found = in_map;
+		if (in_map) {
 			result.tile = tile;
-			result.found = true;
 			result.tile_x = tile_x;
 			result.tile_y = tile_y;
-		} else {
-			height = 0;
 		}
 
 		result.dist = -16 + (ix % 16) - (height);
@@ -576,43 +668,49 @@ SensorResult World::SensorCheckLeft(float x, float y, int layer) {
 }
 
 SensorResult World::GroundSensorCheck(Player* p, float x, float y) {
+	int layer = tilemap.GetCollisionLayer(p->layer);
+
 	switch (p->mode) {
 		case PlayerMode::FLOOR:
-			return SensorCheckDown(x, y, p->layer);
+			return SensorCheckDown(x, y, layer);
 		case PlayerMode::RIGHT_WALL:
-			return SensorCheckRight(x, y, p->layer);
+			return SensorCheckRight(x, y, layer);
 		case PlayerMode::CEILING:
-			return SensorCheckUp(x, y, p->layer);
+			return SensorCheckUp(x, y, layer);
 		case PlayerMode::LEFT_WALL:
-			return SensorCheckLeft(x, y, p->layer);
+			return SensorCheckLeft(x, y, layer);
 	}
 	return {};
 }
 
 SensorResult World::PushSensorECheck(Player* p, float x, float y) {
+	int layer = tilemap.GetCollisionLayer(p->layer);
+
 	switch (p->mode) {
 		case PlayerMode::FLOOR:
-			return SensorCheckLeft(x, y, p->layer);
+			return SensorCheckLeft(x, y, layer);
 		case PlayerMode::RIGHT_WALL:
-			return SensorCheckDown(x, y, p->layer);
+			return SensorCheckDown(x, y, layer);
 		case PlayerMode::CEILING:
-			return SensorCheckRight(x, y, p->layer);
+			return SensorCheckRight(x, y, layer);
 		case PlayerMode::LEFT_WALL:
-			return SensorCheckUp(x, y, p->layer);
+			return SensorCheckUp(x, y, layer);
 	}
 	return {};
 }
 
 SensorResult World::PushSensorFCheck(Player* p, float x, float y) {
+	int layer = tilemap.GetCollisionLayer(p->layer);
+
 	switch (p->mode) {
 		case PlayerMode::FLOOR:
-			return SensorCheckRight(x, y, p->layer);
+			return SensorCheckRight(x, y, layer);
 		case PlayerMode::RIGHT_WALL:
-			return SensorCheckUp(x, y, p->layer);
+			return SensorCheckUp(x, y, layer);
 		case PlayerMode::CEILING:
-			return SensorCheckLeft(x, y, p->layer);
+			return SensorCheckLeft(x, y, layer);
 		case PlayerMode::LEFT_WALL:
-			return SensorCheckDown(x, y, p->layer);
+			return SensorCheckDown(x, y, layer);
 	}
 	return {};
 }
@@ -739,7 +837,7 @@ void World::GroundSensorCollision(Player* p) {
 
 		if (res.found) {
 			float angle = tileset.GetTileAngle(res.tile.index);
-			if (angle == -1.0f) { // flagged
+			if (tileset.GetTileFlags(res.tile.index) & TILE_COLLISION_FLAGGED) {
 				// float a = angle_wrap(p->ground_angle);
 				// if (a <= 45.0f) {
 				// 	p->ground_angle = 0.0f;
@@ -1206,16 +1304,73 @@ void World::Update(float delta) {
 	const Uint8* key = SDL_GetKeyboardState(nullptr);
 	Player* p = &player;
 
+	tilemap.UpdateStreaming(camera_x, camera_y, target_w, target_h);
+
+	if (tileset.UpdateGraphics()) {
+		// planes and chunks still have the old graphics where the tiles are
+		if (tilemap.regions) {
+			// streamed maps aren't indexed, and only the resident regions can
+			// be cached, so look through those
+			for (int region_y = 0; region_y < tilemap.regions_y; region_y++) {
+				for (int region_x = 0; region_x < tilemap.regions_x; region_x++) {
+					TileMapRegion* region = &tilemap.regions[region_x + region_y * tilemap.regions_x];
+					if (!region->resident) {
+						continue;
+					}
+
+					int start_x = region_x * tilemap.region_size;
+					int start_y = region_y * tilemap.region_size;
+					int end_x = min(start_x + tilemap.region_size, tilemap.width);
+					int end_y = min(start_y + tilemap.region_size, tilemap.height);
+
+					for (int layer = 0; layer < tilemap.layer_count; layer++) {
+						for (int tile_y = start_y; tile_y < end_y; tile_y++) {
+							for (int tile_x = start_x; tile_x < end_x; tile_x++) {
+								int index = (tile_x - start_x) + (tile_y - start_y) * tilemap.region_size;
+								Tile tile = region->layers[layer].GetGraphic(index);
+								if (tileset.IsTileChanged(tile.index)) {
+									InvalidateTile(tile_x, tile_y, layer);
+								}
+							}
+						}
+					}
+				}
+			}
+		} else {
+			for (int i = 0; i < tileset.changed_tile_count; i++) {
+				int tile_index = tileset.changed_tiles[i];
+				if (tile_index >= tile_users.tile_count) {
+					continue;
+				}
+
+				for (int j = tile_users.first[tile_index]; j < tile_users.first[tile_index + 1]; j++) {
+					TileUse use = tile_users.uses[j];
+					InvalidateTile(use.x, use.y, use.layer);
+				}
+			}
+		}
+	}
+
+	background.Update(delta);
+
 	{
 		uint32_t prev = input;
 		input = 0;
 
-		input |= INPUT_RIGHT * key[SDL_SCANCODE_RIGHT];
-		input |= INPUT_UP    * key[SDL_SCANCODE_UP];
-		input |= INPUT_LEFT  * key[SDL_SCANCODE_LEFT];
-		input |= INPUT_DOWN  * key[SDL_SCANCODE_DOWN];
-		input |= INPUT_A     * key[SDL_SCANCODE_Z];
-		input |= INPUT_B     * key[SDL_SCANCODE_X];
+		if (game->replay_playing) {
+			PlayReplayFrame(&game->replay, &input);
+		} else {
+			input |= INPUT_RIGHT * key[SDL_SCANCODE_RIGHT];
+			input |= INPUT_UP    * key[SDL_SCANCODE_UP];
+			input |= INPUT_LEFT  * key[SDL_SCANCODE_LEFT];
+			input |= INPUT_DOWN  * key[SDL_SCANCODE_DOWN];
+			input |= INPUT_A     * key[SDL_SCANCODE_Z];
+			input |= INPUT_B     * key[SDL_SCANCODE_X];
+		}
+
+		if (game->record_path) {
+			RecordReplayFrame(&game->recording, input);
+		}
 
 		input_press   = (~prev) & input;
 		input_release = prev & (~input);
@@ -1334,68 +1489,184 @@ void World::Update(float delta) {
 void World::Draw(float delta) {
 	const Uint8* key = SDL_GetKeyboardState(nullptr);
 
-	// draw tilemap
-	{
+	tilemap.UpdateStreaming(camera_x, camera_y, target_w, target_h);
+
+	// the software renderer blits tiles straight to its framebuffer instead
+	if (!GetSoftFramebuffer(game->renderer)) {
+		if (!plane_renderer.Update(&tilemap, &tileset, camera_x, camera_y, target_w, target_h)) {
+			chunk_cache.Update(&tilemap, &tileset, camera_x, camera_y, target_w, target_h);
+		}
+	}
+
+	if (key[SDL_SCANCODE_1] || key[SDL_SCANCODE_2] || key[SDL_SCANCODE_3] || key[SDL_SCANCODE_4]
+		|| key[SDL_SCANCODE_5] || key[SDL_SCANCODE_6] || key[SDL_SCANCODE_7]) {
+		tileset.RequestCollisionTextures();
+	}
+
+	// draw tilemap, one priority at a time
+	auto draw_tile_layer = [&](int layer, bool priority) {
 		int start_x = max(int(camera_x) / 16, 0);
 		int start_y = max(int(camera_y) / 16, 0);
 
 		int end_x = min((int(camera_x) + target_w) / 16, tilemap.width  - 1);
 		int end_y = min((int(camera_y) + target_h) / 16, tilemap.height - 1);
 
-		for (int y = start_y; y <= end_y; y++) {
-			for (int x = start_x; x <= end_x; x++) {
-				Tile tile = tilemap.GetTileA(x, y);
+		// the plane if there is one, else whole chunks from the cache, and tiles
+		// of chunks it had no room for are batched
+		bool drawn = false;
+
+		SoftFramebuffer* fb = GetSoftFramebuffer(game->renderer);
+		if (fb && tileset.surface) {
+			for (int y = start_y; y <= end_y; y++) {
+				for (int x = start_x; x <= end_x; x++) {
+					Tile tile = tilemap.GetTileGraphicUnchecked(x, y, layer);
+					if (tile.priority != priority) {
+						continue;
+					}
 
-				SDL_Rect src = tileset.GetTextureSrcRect(tile.index);
+					int flip = SDL_FLIP_NONE;
+					if (tile.hflip) flip |= SDL_FLIP_HORIZONTAL;
+					if (tile.vflip) flip |= SDL_FLIP_VERTICAL;
 
-				SDL_Rect dest = {
-					x * 16 - int(camera_x),
-					y * 16 - int(camera_y),
-					16,
-					16
-				};
+					SoftBlitTile(fb, tileset.surface, tileset.GetTextureSrcRect(tile.index),
+								 x * 16 - int(camera_x), y * 16 - int(camera_y), flip);
+				}
+			}
 
-				int flip = SDL_FLIP_NONE;
-				if (tile.hflip) flip |= SDL_FLIP_HORIZONTAL;
-				if (tile.vflip) flip |= SDL_FLIP_VERTICAL;
-				SDL_RenderCopyEx(game->renderer, tileset.texture, &src, &dest, 0.0, nullptr, (SDL_RendererFlip) flip);
+			drawn = true;
+		} else {
+			drawn = plane_renderer.Draw(layer, priority, camera_x, camera_y);
+		}
 
-				if (key[SDL_SCANCODE_3]) {
-					if (tile.hflip || tile.vflip) {
-						SDL_SetTextureColorMod(tileset.height_texture, 128, 128, 128);
-					} else {
-						SDL_SetTextureColorMod(tileset.height_texture, 255, 255, 255);
-					}
-					SDL_RenderCopyEx(game->renderer, tileset.height_texture, &src, &dest, 0.0, nullptr, (SDL_RendererFlip) flip);
-					SDL_SetTextureColorMod(tileset.height_texture, 255, 255, 255);
-				}
-				if (key[SDL_SCANCODE_4]) {
-					if (tile.hflip || tile.vflip) {
-						SDL_SetTextureColorMod(tileset.width_texture, 128, 128, 128);
-					} else {
-						SDL_SetTextureColorMod(tileset.width_texture, 255, 255, 255);
-					}
-					SDL_RenderCopyEx(game->renderer, tileset.width_texture, &src, &dest, 0.0, nullptr, (SDL_RendererFlip) flip);
-					SDL_SetTextureColorMod(tileset.width_texture, 255, 255, 255);
+		tile_batch.Begin(tileset.texture);
+
+		for (int chunk_y = start_y / CHUNK_TILES; chunk_y <= end_y / CHUNK_TILES && !drawn; chunk_y++) {
+			for (int chunk_x = start_x / CHUNK_TILES; chunk_x <= end_x / CHUNK_TILES; chunk_x++) {
+				if (SDL_Texture* texture = chunk_cache.FindChunk(chunk_x, chunk_y, layer, priority)) {
+					SDL_Rect dest = {
+						chunk_x * CHUNK_SIZE - int(camera_x),
+						chunk_y * CHUNK_SIZE - int(camera_y),
+						CHUNK_SIZE,
+						CHUNK_SIZE
+					};
+					SDL_RenderCopy(game->renderer, texture, nullptr, &dest);
+					continue;
 				}
-				if (key[SDL_SCANCODE_5]) {
-					float angle = tileset.GetTileAngle(tile.index);
-					if (angle == -1.0f && (tile.top_solid || tile.left_right_bottom_solid)) {
-						DrawTextShadow(game->renderer, &fnt_cp437, "*", dest.x + 8, dest.y + 8, HALIGN_CENTER, VALIGN_MIDDLE);
+
+				int chunk_start_x = max(chunk_x * CHUNK_TILES, start_x);
+				int chunk_start_y = max(chunk_y * CHUNK_TILES, start_y);
+				int chunk_end_x = min(chunk_x * CHUNK_TILES + CHUNK_TILES - 1, end_x);
+				int chunk_end_y = min(chunk_y * CHUNK_TILES + CHUNK_TILES - 1, end_y);
+
+				for (int y = chunk_start_y; y <= chunk_end_y; y++) {
+					for (int x = chunk_start_x; x <= chunk_end_x; x++) {
+						Tile tile = tilemap.GetTileGraphicUnchecked(x, y, layer);
+						if (tile.priority != priority) {
+							continue;
+						}
+
+						SDL_Rect src = tileset.GetTextureSrcRect(tile.index);
+
+						SDL_Rect dest = {
+							x * 16 - int(camera_x),
+							y * 16 - int(camera_y),
+							16,
+							16
+						};
+
+						int flip = SDL_FLIP_NONE;
+						if (tile.hflip) flip |= SDL_FLIP_HORIZONTAL;
+						if (tile.vflip) flip |= SDL_FLIP_VERTICAL;
+						tile_batch.Add(src, dest, flip);
 					}
 				}
-				if (key[SDL_SCANCODE_6]) {
-					if (tile.top_solid) {
-						SDL_RenderCopyEx(game->renderer, tileset.height_texture, &src, &dest, 0.0, nullptr, (SDL_RendererFlip) flip);
+			}
+		}
+
+		tile_batch.Flush();
+
+		// collision overlays, they need solidity too, on top of both passes
+		if (!priority || !(tilemap.layer_flags[layer] & TILE_LAYER_COLLISION)) {
+			return;
+		}
+
+		// one batch per overlay, in the order they stack
+		auto draw_overlay = [&](SDL_Texture* texture, int overlay_key) {
+			if (!texture) {
+				return;
+			}
+
+			tile_batch.Begin(texture);
+
+			for (int y = start_y; y <= end_y; y++) {
+				for (int x = start_x; x <= end_x; x++) {
+					Tile tile = tilemap.GetTileUnchecked(x, y, layer);
+
+					SDL_Color color = {255, 255, 255, 255};
+					switch (overlay_key) {
+						case SDL_SCANCODE_3:
+						case SDL_SCANCODE_4: {
+							if (tile.hflip || tile.vflip) {
+								color = {128, 128, 128, 255};
+							}
+							break;
+						}
+						case SDL_SCANCODE_6: {
+							if (!tile.top_solid) continue;
+							break;
+						}
+						case SDL_SCANCODE_7: {
+							if (!tile.left_right_bottom_solid) continue;
+							break;
+						}
 					}
+
+					SDL_Rect col_src = tileset.GetCollisionSrcRect(tile.index);
+
+					SDL_Rect dest = {
+						x * 16 - int(camera_x),
+						y * 16 - int(camera_y),
+						16,
+						16
+					};
+
+					int flip = SDL_FLIP_NONE;
+					if (tile.hflip) flip |= SDL_FLIP_HORIZONTAL;
+					if (tile.vflip) flip |= SDL_FLIP_VERTICAL;
+					tile_batch.Add(col_src, dest, flip, color);
 				}
-				if (key[SDL_SCANCODE_7]) {
-					if (tile.left_right_bottom_solid) {
-						SDL_RenderCopyEx(game->renderer, tileset.height_texture, &src, &dest, 0.0, nullptr, (SDL_RendererFlip) flip);
+			}
+
+			tile_batch.Flush();
+		};
+
+		if (key[SDL_SCANCODE_3]) draw_overlay(tileset.height_texture, SDL_SCANCODE_3);
+		if (key[SDL_SCANCODE_4]) draw_overlay(tileset.width_texture,  SDL_SCANCODE_4);
+
+		if (key[SDL_SCANCODE_5]) {
+			for (int y = start_y; y <= end_y; y++) {
+				for (int x = start_x; x <= end_x; x++) {
+					Tile tile = tilemap.GetTileUnchecked(x, y, layer);
+					if ((tileset.GetTileFlags(tile.index) & TILE_COLLISION_FLAGGED) && (tile.top_solid || tile.left_right_bottom_solid)) {
+						int dest_x = x * 16 - int(camera_x);
+						int dest_y = y * 16 - int(camera_y);
+						DrawTextShadow(game->renderer, &fnt_cp437, "*", dest_x + 8, dest_y + 8, HALIGN_CENTER, VALIGN_MIDDLE);
 					}
 				}
 			}
 		}
+
+		if (key[SDL_SCANCODE_6]) draw_overlay(tileset.height_texture, SDL_SCANCODE_6);
+		if (key[SDL_SCANCODE_7]) draw_overlay(tileset.height_texture, SDL_SCANCODE_7);
+	};
+
+	background.Draw(camera_x, camera_y, target_w, target_h);
+
+	// low priority tiles of background layers go behind sprites
+	for (int i = 0; i < tilemap.layer_count; i++) {
+		if (tilemap.layer_flags[i] & TILE_LAYER_BACKGROUND) {
+			draw_tile_layer(i, false);
+		}
 	}
 
 	Player* p = &player;
@@ -1405,7 +1676,7 @@ void World::Draw(float delta) {
 		Object* inst = &objects[i];
 		switch (inst->type) {
 			case ObjType::VERTICAL_LAYER_SWITCHER: {
-				SDL_SetRenderDrawColor(game->renderer, 128, 128, 255, 128);
+				SDL_Color color = {128, 128, 255, 128};
 				if (inst->current_side == 1) {
 					SDL_Rect rect = {
 						int(inst->x - 32.0f) - int(camera_x),
@@ -1413,7 +1684,7 @@ void World::Draw(float delta) {
 						32,
 						int(inst->radius * 2.0f)
 					};
-					SDL_RenderFillRect(game->renderer, &rect);
+					draw_list.AddRect(rect, color, DRAW_LAYER_OBJECTS);
 				} else if (inst->current_side == 0) {
 					SDL_Rect rect = {
 						int(inst->x) - int(camera_x),
@@ -1421,7 +1692,7 @@ void World::Draw(float delta) {
 						32,
 						int(inst->radius * 2.0f)
 					};
-					SDL_RenderFillRect(game->renderer, &rect);
+					draw_list.AddRect(rect, color, DRAW_LAYER_OBJECTS);
 				}
 				break;
 			}
@@ -1458,7 +1729,23 @@ void World::Draw(float delta) {
 			a = 0.0;
 		}
 
-		SDL_RenderCopyEx(game->renderer, anim_get_texture(p->anim), &src, &dest, a, nullptr, flip);
+		draw_list.AddSprite(anim_get_texture(p->anim), anim_get_surface(p->anim), src, dest, float(a), flip, DRAW_LAYER_PLAYER);
+	}
+
+	draw_list.Flush();
+
+	// high priority tiles go in front, like the loops and tunnels of the originals
+	for (int i = 0; i < tilemap.layer_count; i++) {
+		if (tilemap.layer_flags[i] & TILE_LAYER_BACKGROUND) {
+			draw_tile_layer(i, true);
+		}
+	}
+
+	for (int i = 0; i < tilemap.layer_count; i++) {
+		if (tilemap.layer_flags[i] & TILE_LAYER_FOREGROUND) {
+			draw_tile_layer(i, false);
+			draw_tile_layer(i, true);
+		}
 	}
 
 	// draw player hitbox
@@ -1563,30 +1850,32 @@ void World::Draw(float delta) {
 		SDL_SetRenderDrawColor(game->renderer, 196, 196, 196, 255);
 		SDL_RenderDrawRect(game->renderer, &rect);
 
+		int layer = tilemap.GetCollisionLayer(player.layer);
+
 		SDL_SetRenderDrawColor(game->renderer, 255, 255, 255, 255);
 		if (key[SDL_SCANCODE_RIGHT]) {
-			SensorResult res = SensorCheckRight(x, y, 0);
+			SensorResult res = SensorCheckRight(x, y, layer);
 			SDL_RenderDrawLine(game->renderer,
 							   int(x) - int(camera_x),
 							   int(y) - int(camera_y),
 							   int(x) + res.dist - int(camera_x),
 							   int(y) - int(camera_y));
 		} else if (key[SDL_SCANCODE_UP]) {
-			SensorResult res = SensorCheckUp(x, y, 0);
+			SensorResult res = SensorCheckUp(x, y, layer);
 			SDL_RenderDrawLine(game->renderer,
 							   int(x) - int(camera_x),
 							   int(y) - int(camera_y),
 							   int(x) - int(camera_x),
 							   int(y) - res.dist - int(camera_y));
 		} else if (key[SDL_SCANCODE_LEFT]) {
-			SensorResult res = SensorCheckLeft(x, y, 0);
+			SensorResult res = SensorCheckLeft(x, y, layer);
 			SDL_RenderDrawLine(game->renderer,
 							   int(x) - int(camera_x),
 							   int(y) - int(camera_y),
 							   int(x) - res.dist - int(camera_x),
 							   int(y) - int(camera_y));
 		} else {
-			SensorResult res = SensorCheckDown(x, y, 0);
+			SensorResult res = SensorCheckDown(x, y, layer);
 			SDL_RenderDrawLine(game->renderer,
 							   int(x) - int(camera_x),
 							   int(y) - int(camera_y),
@@ -1607,6 +1896,136 @@ void World::Draw(float delta) {
 	}
 }
 
+void World::BenchmarkSensors() {
+	sensor_trace.recording = false;
+
+	if (tilemap.regions) {
+		SDL_Log("Sensor benchmark needs the whole tilemap resident.");
+		return;
+	}
+
+	if (sensor_trace.count == 0) {
+		SDL_Log("No sensor casts were recorded.");
+		return;
+	}
+
+	PerfCounters counters;
+	if (!OpenPerfCounters(&counters)) {
+		SDL_Log("Timing only, no cache misses: %s.", SDL_GetError());
+	}
+
+	TileMapLayout original_layout = tilemap.layout;
+	TileCollisionLayout original_collision_layout = tileset.collision_layout;
+
+	TileMapLayout layouts[] = {TileMapLayout::ROW_MAJOR, TileMapLayout::BLOCKED};
+	const char* layout_names[] = {"row-major", "blocked"};
+
+	TileCollisionLayout collision_layouts[] = {TileCollisionLayout::SPLIT, TileCollisionLayout::INTERLEAVED};
+	const char* collision_layout_names[] = {"split", "interleaved"};
+
+	const int passes = 10;
+
+	double best_ms[ArrayLength(layouts) * ArrayLength(collision_layouts)] = {};
+	double l1d_per_cast[ArrayLength(layouts) * ArrayLength(collision_layouts)] = {};
+
+	SDL_Log("Casting %d recorded sensor queries %d times per layout.", sensor_trace.count, passes);
+
+	for (size_t i = 0; i < ArrayLength(layouts) * ArrayLength(collision_layouts); i++) {
+		size_t layout = i % ArrayLength(layouts);
+		size_t collision_layout = i / ArrayLength(layouts);
+
+		tilemap.SetLayout(layouts[layout]);
+		tileset.collision_layout = collision_layouts[collision_layout];
+
+		// the fastest pass, and the misses of all passes together
+		double best = 0.0;
+		uint64_t misses[PERF_COUNTER_COUNT] = {};
+		int checksum = 0;
+
+		for (int pass = 0; pass < passes; pass++) {
+			uint64_t values[PERF_COUNTER_COUNT];
+			StartPerfCounters(&counters);
+			double t = GetTime();
+
+			for (int j = 0; j < sensor_trace.count; j++) {
+				SensorQuery q = sensor_trace.queries[j];
+				switch (q.direction) {
+					case SENSOR_DOWN:  checksum += SensorCheckDown (q.x, q.y, q.layer).dist; break;
+					case SENSOR_RIGHT: checksum += SensorCheckRight(q.x, q.y, q.layer).dist; break;
+					case SENSOR_UP:    checksum += SensorCheckUp   (q.x, q.y, q.layer).dist; break;
+					case SENSOR_LEFT:  checksum += SensorCheckLeft (q.x, q.y, q.layer).dist; break;
+				}
+			}
+
+			double took = (GetTime() - t) * 1000.0;
+			StopPerfCounters(&counters, values);
+
+			if (pass == 0 || took < best) {
+				best = took;
+			}
+			for (int k = 0; k < PERF_COUNTER_COUNT; k++) {
+				misses[k] += values[k];
+			}
+		}
+
+		double casts = double(sensor_trace.count) * double(passes);
+
+		best_ms[i] = best;
+		l1d_per_cast[i] = double(misses[PERF_L1D_MISSES]) / casts;
+
+		if (counters.open) {
+			SDL_Log("%-9s %-11s best %.3fms (%.1fns per cast), %.3f L1D / %.4f LLC misses per cast, checksum %d",
+					layout_names[layout],
+					collision_layout_names[collision_layout],
+					best,
+					best * 1000000.0 / double(sensor_trace.count),
+					double(misses[PERF_L1D_MISSES]) / casts,
+					double(misses[PERF_LLC_MISSES]) / casts,
+					checksum);
+		} else {
+			SDL_Log("%-9s %-11s best %.3fms (%.1fns per cast), checksum %d",
+					layout_names[layout],
+					collision_layout_names[collision_layout],
+					best,
+					best * 1000000.0 / double(sensor_trace.count),
+					checksum);
+		}
+	}
+
+	// same casts, same tile layout, only the collision profiles differ
+	for (size_t layout = 0; layout < ArrayLength(layouts); layout++) {
+		size_t split = layout;
+		size_t interleaved = layout + ArrayLength(layouts);
+
+		if (counters.open) {
+			SDL_Log("%-9s interleaved vs split: %.2fx the time, %.3f vs %.3f L1D misses per cast",
+					layout_names[layout],
+					best_ms[interleaved] / best_ms[split],
+					l1d_per_cast[interleaved],
+					l1d_per_cast[split]);
+		} else {
+			SDL_Log("%-9s interleaved vs split: %.2fx the time",
+					layout_names[layout],
+					best_ms[interleaved] / best_ms[split]);
+		}
+	}
+
+	ClosePerfCounters(&counters);
+
+	tilemap.SetLayout(original_layout);
+	tileset.collision_layout = original_collision_layout;
+}
+
+void World::InvalidateTile(int tile_x, int tile_y, int layer) {
+	plane_renderer.InvalidateTile(tile_x, tile_y, layer);
+	chunk_cache.InvalidateTile(tile_x, tile_y, layer);
+}
+
+void World::InvalidateTileGraphics() {
+	plane_renderer.Clear();
+	chunk_cache.Clear();
+}
+
 Object* World::CreateObject(ObjType type) {
 	if (object_count == MAX_OBJECTS) {
 		object_count--;
@@ -4,6 +4,12 @@
 
 #include "TileSet.h"
 #include "TileMap.h"
+#include "ChunkCache.h"
+#include "PlaneRenderer.h"
+#include "TileBatch.h"
+#include "DrawList.h"
+#include "Background.h"
+#include "TileUsers.h"
 
 #define MAX_OBJECTS 1024
 
@@ -29,6 +35,29 @@ struct SensorResult {
 	int tile_y;
 };
 
+enum {
+	SENSOR_DOWN,
+	SENSOR_RIGHT,
+	SENSOR_UP,
+	SENSOR_LEFT
+};
+
+struct SensorQuery {
+	float x;
+	float y;
+	uint8_t layer;
+	uint8_t direction;
+};
+
+// With --bench-sensors every sensor cast is recorded while the replay plays,
+// so BenchmarkSensors can cast the same ones again with each layout.
+struct SensorTrace {
+	SensorQuery* queries;
+	int count;
+	int capacity;
+	bool recording;
+};
+
 struct World {
 	Player player;
 	Object* objects;
@@ -46,9 +75,27 @@ struct World {
 	TileSet tileset;
 	TileMap tilemap;
 
+	// Layers are drawn from planes, or from cached chunks if there are no
+	// planes. Call InvalidateTile after changing a tile, or
+	// InvalidateTileGraphics after loading a level.
+	// tile_users has to be built again after changing the tilemap, the cells
+	// of animated tiles are invalidated through it.
+	TileUsers tile_users;
+	PlaneRenderer plane_renderer;
+	ChunkCache chunk_cache;
+	TileBatch tile_batch;
+
+	// objects and the player, drawn between the background and foreground layers
+	DrawList draw_list;
+
+	// behind everything, if the level has one
+	Background background;
+
 	int target_w;
 	int target_h;
 
+	SensorTrace sensor_trace;
+
 	bool debug;
 	bool was_debug;
 
@@ -57,6 +104,9 @@ struct World {
 	void Update(float delta);
 	void Draw(float delta);
 
+	void InvalidateTile(int tile_x, int tile_y, int layer);
+	void InvalidateTileGraphics();
+
 	Object* CreateObject(ObjType type);
 
 	void UpdatePlayer(Player* p, float delta);
@@ -81,4 +131,8 @@ struct World {
 	bool IsPushSensorFActive   (Player* p);
 
 	void load_objects(const char* fname);
+
+	// Casts the recorded sensor trace again with each tile layout and each
+	// collision layout, and logs the time and cache misses per cast.
+	void BenchmarkSensors();
 };
@@ -6,11 +6,17 @@ int main(int argc, char* argv[]) {
 	Game game_instance{};
 	game = &game_instance;
 
+	game->ParseArgs(argc, argv);
+
+	if (game->render_test_suite) {
+		return RunRenderTestSuite(argv[0], game->render_test_suite, game->render_test.update);
+	}
+
 	game->Init();
 	game->Run();
 	game->Quit();
 
-	return 0;
+	return game->exit_code;
 }
 
 #else
@@ -12,6 +12,9 @@
 #include <math.h>
 #include "../../CppSonic/src/mathh.h"
 #include "../../CppSonic/src/misc.h"
+#include "../../CppSonic/src/Compression.h"
+#include "../../CppSonic/src/TileAtlas.h"
+#include "../../CppSonic/src/TileDedup.h"
 
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_sdl2.h"
@@ -23,6 +26,10 @@
 #include <direct.h>
 
 int selected_tile = 0;
+int selected_layer = 0;
+
+// the image the tileset texture was loaded from, the atlas is built from it on export
+char tileset_texture_source[256];
 float tilemap_zoom = 1;
 
 int window_w = 1600;
@@ -46,7 +53,7 @@ int mode = MODE_TILEMAP;
 struct {
 	bool show;
 	char level_data_path[256] = "levels/ghz1.bin";
-	char chunk_data_path[256] = "map256/GHZ.bin";
+	char chunk_data_path[256] = "map256/GHZ.kos";
 	char tile_height_data_path[256] = "collide/Collision Array (Normal).bin";
 	char tile_width_data_path[256] = "collide/Collision Array (Rotated).bin";
 	char tile_angle_data_path[256] = "collide/Angle Map.bin";
@@ -60,6 +67,10 @@ struct {
 	char tileset_path[256] = "../CppSonic/levels/export/tileset.bin";
 	char tilemap_path[256] = "../CppSonic/levels/export/tilemap.bin";
 	char objects_path[256] = "../CppSonic/levels/export/objects.bin";
+	char tileset_texture_path[256] = "../CppSonic/levels/export/tileset_padded.png";
+	bool compress = false; // LZ4, opt in
+	bool split_into_regions = false;
+	bool build_atlas = true;
 } export_window;
 
 struct {
@@ -92,6 +103,7 @@ static bool ButtonCentered(const char* label, float alignment = 0.5f) {
 static void import_s1_level() {
 	world->tileset.Destroy();
 	world->tilemap.Destroy();
+	world->InvalidateTileGraphics();
 
 	std::vector<uint8_t> level_data;
 	std::vector<uint16_t> level_chunk_data;
@@ -103,7 +115,7 @@ static void import_s1_level() {
 
 	{
 		size_t size;
-		uint8_t* data = (uint8_t*) SDL_LoadFile(s1_import_window.level_data_path, &size);
+		uint8_t* data = (uint8_t*) LoadFileDecompressed(s1_import_window.level_data_path, &size);
 		if (!data || !size) return;
 		level_data.assign(data, data + size / sizeof(*data));
 		SDL_free(data);
@@ -111,7 +123,7 @@ static void import_s1_level() {
 
 	{
 		size_t size;
-		uint16_t* data = (uint16_t*) SDL_LoadFile(s1_import_window.chunk_data_path, &size);
+		uint16_t* data = (uint16_t*) LoadFileDecompressed(s1_import_window.chunk_data_path, &size);
 		if (!data || !size) return;
 		level_chunk_data.assign(data, data + size / sizeof(*data));
 		SDL_free(data);
@@ -119,7 +131,7 @@ static void import_s1_level() {
 
 	{
 		size_t size;
-		uint8_t* data = (uint8_t*) SDL_LoadFile(s1_import_window.tile_height_data_path, &size);
+		uint8_t* data = (uint8_t*) LoadFileDecompressed(s1_import_window.tile_height_data_path, &size);
 		if (!data || !size) return;
 		collision_array.assign(data, data + size / sizeof(*data));
 		SDL_free(data);
@@ -127,7 +139,7 @@ static void import_s1_level() {
 
 	{
 		size_t size;
-		uint8_t* data = (uint8_t*) SDL_LoadFile(s1_import_window.tile_width_data_path, &size);
+		uint8_t* data = (uint8_t*) LoadFileDecompressed(s1_import_window.tile_width_data_path, &size);
 		if (!data || !size) return;
 		collision_array_rot.assign(data, data + size / sizeof(*data));
 		SDL_free(data);
@@ -135,7 +147,7 @@ static void import_s1_level() {
 
 	{
 		size_t size;
-		uint8_t* data = (uint8_t*) SDL_LoadFile(s1_import_window.tile_indicies_path, &size);
+		uint8_t* data = (uint8_t*) LoadFileDecompressed(s1_import_window.tile_indicies_path, &size);
 		if (!data || !size) return;
 		level_col_indicies.assign(data, data + size / sizeof(*data));
 		SDL_free(data);
@@ -143,7 +155,7 @@ static void import_s1_level() {
 
 	{
 		size_t size;
-		uint16_t* data = (uint16_t*) SDL_LoadFile(s1_import_window.startpos_file_path, &size);
+		uint16_t* data = (uint16_t*) LoadFileDecompressed(s1_import_window.startpos_file_path, &size);
 		if (!data || !size) return;
 		startpos.assign(data, data + size / sizeof(*data));
 		SDL_free(data);
@@ -151,14 +163,22 @@ static void import_s1_level() {
 
 	{
 		size_t size;
-		uint8_t* data = (uint8_t*) SDL_LoadFile(s1_import_window.tile_angle_data_path, &size);
+		uint8_t* data = (uint8_t*) LoadFileDecompressed(s1_import_window.tile_angle_data_path, &size);
 		if (!data || !size) return;
 		angle_map.assign(data, data + size / sizeof(*data));
 		SDL_free(data);
 	}
 
+	// the collision array is the profile table, the tiles index into it
+	int profile_count = (int) min(min(collision_array.size(), collision_array_rot.size()) / 16, angle_map.size());
+	if (profile_count > TILESET_MAX_PROFILES) {
+		SDL_Log("The collision array has %d shapes, only %d fit in the profile table.", profile_count, TILESET_MAX_PROFILES);
+		ErrorMessageBox("Level has more than %d collision shapes.", TILESET_MAX_PROFILES);
+		return;
+	}
+
 	world->tileset.texture = IMG_LoadTexture(game->renderer, s1_import_window.tileset_texture);
-	world->tileset.tiles_in_row = 16;
+	stb_snprintf(tileset_texture_source, sizeof(tileset_texture_source), "%s", s1_import_window.tileset_texture);
 
 	if (!world->tileset.texture) {
 		return;
@@ -179,11 +199,7 @@ static void import_s1_level() {
 		return;
 	}
 
-	world->tilemap.width  = level_width_in_chunks  * 16;
-	world->tilemap.height = level_height_in_chunks * 16;
-	world->tilemap.tile_count = world->tilemap.width * world->tilemap.height;
-	world->tilemap.tiles_a = (Tile*) calloc(world->tilemap.tile_count, sizeof(*world->tilemap.tiles_a));
-	world->tilemap.tiles_b = (Tile*) calloc(world->tilemap.tile_count, sizeof(*world->tilemap.tiles_b));
+	world->tilemap.Create(level_width_in_chunks * 16, level_height_in_chunks * 16);
 
 	for (size_t i = 0; i < level_chunk_data.size(); i++) {
 		level_chunk_data[i] = SDL_Swap16(level_chunk_data[i]);
@@ -202,9 +218,7 @@ static void import_s1_level() {
 	world->camera_y = world->player.y - float(GAME_H) / 2.0f;
 
 	world->tileset.tile_count = (texture_w / 16) * (texture_h / 16);
-	world->tileset.tile_heights = (uint8_t*) calloc(world->tileset.tile_count, 16 * sizeof(*world->tileset.tile_heights));
-	world->tileset.tile_widths = (uint8_t*) calloc(world->tileset.tile_count, 16 * sizeof(*world->tileset.tile_widths));
-	world->tileset.tile_angles = (float*) calloc(world->tileset.tile_count, sizeof(*world->tileset.tile_angles));
+	world->tileset.SetGridSrcRects(texture_w / 16, 0);
 
 	for (int y = 0; y < world->tilemap.height; y++) {
 		for (int x = 0; x < world->tilemap.width; x++) {
@@ -225,58 +239,163 @@ static void import_s1_level() {
 
 			uint16_t tile = tiles[tile_in_chunk_x + tile_in_chunk_y * 16];
 
-			world->tilemap.tiles_a[x + y * world->tilemap.width].index = tile & 0b0000'0011'1111'1111;
-			world->tilemap.tiles_a[x + y * world->tilemap.width].hflip = tile & 0b0000'1000'0000'0000;
-			world->tilemap.tiles_a[x + y * world->tilemap.width].vflip = tile & 0b0001'0000'0000'0000;
-			world->tilemap.tiles_a[x + y * world->tilemap.width].top_solid = tile & 0b0010'0000'0000'0000;
-			world->tilemap.tiles_a[x + y * world->tilemap.width].left_right_bottom_solid = tile & 0b0100'0000'0000'0000;
+			Tile a = {};
+			a.index = tile & 0b0000'0011'1111'1111;
+			a.hflip = tile & 0b0000'1000'0000'0000;
+			a.vflip = tile & 0b0001'0000'0000'0000;
+			a.top_solid = tile & 0b0010'0000'0000'0000;
+			a.left_right_bottom_solid = tile & 0b0100'0000'0000'0000;
+			a.priority = tile & 0b1000'0000'0000'0000;
+			world->tilemap.SetTile(x, y, 0, a);
 
 			if (loop) {
 				chunk_index++;
 				tiles = &level_chunk_data[(chunk_index - 1) * 256];
 				tile = tiles[tile_in_chunk_x + tile_in_chunk_y * 16];
 
-				world->tilemap.tiles_b[x + y * world->tilemap.width].index = tile & 0b0000'0011'1111'1111;
-				world->tilemap.tiles_b[x + y * world->tilemap.width].hflip = tile & 0b0000'1000'0000'0000;
-				world->tilemap.tiles_b[x + y * world->tilemap.width].vflip = tile & 0b0001'0000'0000'0000;
-				world->tilemap.tiles_b[x + y * world->tilemap.width].top_solid = tile & 0b0010'0000'0000'0000;
-				world->tilemap.tiles_b[x + y * world->tilemap.width].left_right_bottom_solid = tile & 0b0100'0000'0000'0000;
+				Tile b = {};
+				b.index = tile & 0b0000'0011'1111'1111;
+				b.hflip = tile & 0b0000'1000'0000'0000;
+				b.vflip = tile & 0b0001'0000'0000'0000;
+				b.top_solid = tile & 0b0010'0000'0000'0000;
+				b.left_right_bottom_solid = tile & 0b0100'0000'0000'0000;
+				b.priority = tile & 0b1000'0000'0000'0000;
+				world->tilemap.SetTile(x, y, 1, b);
 			}
 		}
 	}
 
-	for (size_t i = 0; i < level_col_indicies.size(); i++) {
-		uint8_t index = level_col_indicies[i];
-		uint8_t* height = &collision_array[index * 16];
-		uint8_t* width = &collision_array_rot[index * 16];
+	profile_count = max(profile_count, 1);
+
+	world->tileset.AllocateProfiles(profile_count, world->tileset.tile_count);
+
+	for (int i = 0; i < profile_count; i++) {
+		uint8_t* height = &collision_array[i * 16];
+		uint8_t* width = &collision_array_rot[i * 16];
 
 		for (size_t j = 0; j < 16; j++) {
-			world->tileset.tile_heights[i * 16 + j] = height[j];
-			world->tileset.tile_widths[i * 16 + j] = width[j];
+			world->tileset.profile_heights[i * 16 + j] = height[j];
+			world->tileset.profile_widths[i * 16 + j] = width[j];
 		}
 
-		uint8_t angle = angle_map[index];
+		uint8_t angle = angle_map[i];
 		if (angle == 0xFF) { // flagged
-			world->tileset.tile_angles[i] = -1.0f;
+			world->tileset.profile_angles[i] = -1.0f;
 		} else {
-			world->tileset.tile_angles[i] = (float(256 - int(angle)) / 256.0f) * 360.0f;
+			world->tileset.profile_angles[i] = (float(256 - int(angle)) / 256.0f) * 360.0f;
 		}
 	}
 
-	world->tileset.GenCollisionTextures();
+	world->tileset.UpdateProfileRecords();
+
+	for (size_t i = 0; i < level_col_indicies.size() && i < (size_t) world->tileset.tile_count; i++) {
+		uint8_t index = level_col_indicies[i];
+		if (index < profile_count) {
+			world->tileset.tile_profiles[i] = index;
+		} else {
+			SDL_Log("Tile %d uses collision shape %d, but the collision array only has %d.", (int) i, index, profile_count);
+		}
+	}
+
+	BuildTileUsers(&world->tile_users, &world->tilemap, &world->tileset);
+}
+
+// Set by a failed or short write. A file is reported and the flag reset when
+// it's closed, so a broken export never goes unnoticed.
+static bool export_failed;
+
+static void export_write(SDL_RWops* f, const void* data, size_t size, size_t count) {
+	if (count > 0 && SDL_RWwrite(f, data, size, count) != count) {
+		export_failed = true;
+	}
+}
+
+static void export_write_section(SDL_RWops* f, const void* data, size_t size) {
+	if (!LZ4WriteSection(f, data, size)) {
+		export_failed = true;
+	}
+}
+
+static void export_close(SDL_RWops* f, const char* fname) {
+	if (SDL_RWclose(f) != 0) {
+		export_failed = true;
+	}
+
+	if (export_failed) {
+		char buf[512];
+		stb_snprintf(buf, sizeof(buf), "Couldn't write %s, the file is incomplete. %s", fname, SDL_GetError());
+		SDL_ShowSimpleMessageBox(0, "ERROR", buf, nullptr);
+	}
+
+	export_failed = false;
 }
 
 static void export_level() {
+	export_failed = false;
+
+	if (world->tilemap.regions) {
+		SDL_ShowSimpleMessageBox(0, "ERROR", "Can't export a tilemap that is split into regions. Import it unsplit first.", nullptr);
+		return;
+	}
+
+	// pack the tiles into a new texture, the exported table points into it
+	TileAtlas atlas = {};
+	SDL_Rect* src_rects = world->tileset.src_rects;
+	if (export_window.build_atlas) {
+		SDL_Surface* surf = IMG_Load(tileset_texture_source);
+		if (surf && BuildTileAtlas(&atlas, surf, world->tileset.src_rects, world->tileset.tile_count)) {
+			if (IMG_SavePNG(atlas.surface, export_window.tileset_texture_path) == 0) {
+				src_rects = atlas.src_rects;
+				SDL_Log("Tileset atlas: %d tiles, %d unique, %dx%d.",
+						atlas.tile_count, atlas.unique_count, atlas.surface->w, atlas.surface->h);
+			} else {
+				SDL_ShowSimpleMessageBox(0, "ERROR", "Couldn't save the tileset atlas.", nullptr);
+			}
+		} else {
+			SDL_ShowSimpleMessageBox(0, "ERROR", "Couldn't build the tileset atlas.", nullptr);
+		}
+		if (surf) SDL_FreeSurface(surf);
+	}
+
 	{
 		if (SDL_RWops* f = SDL_RWFromFile(export_window.tileset_path, "wb")) {
 			int tile_count = world->tileset.tile_count;
-			SDL_RWwrite(f, &tile_count, sizeof(tile_count), 1);
-
-			SDL_RWwrite(f, world->tileset.tile_heights, 16 * sizeof(*world->tileset.tile_heights), tile_count);
-			SDL_RWwrite(f, world->tileset.tile_widths, 16 * sizeof(*world->tileset.tile_widths), tile_count);
-			SDL_RWwrite(f, world->tileset.tile_angles, sizeof(*world->tileset.tile_angles), tile_count);
+			int profile_count = world->tileset.profile_count;
+			int profiles_magic = TILESET_PROFILES_MAGIC;
+
+			if (export_window.compress) {
+				int magic = LZ4_LEVEL_MAGIC;
+				export_write(f, &magic, sizeof(magic), 1);
+				export_write(f, &profiles_magic, sizeof(profiles_magic), 1);
+				export_write(f, &profile_count, sizeof(profile_count), 1);
+				export_write(f, &tile_count, sizeof(tile_count), 1);
+
+				export_write_section(f, world->tileset.profile_heights, profile_count * 16 * sizeof(*world->tileset.profile_heights));
+				export_write_section(f, world->tileset.profile_widths, profile_count * 16 * sizeof(*world->tileset.profile_widths));
+				export_write_section(f, world->tileset.profile_angles, profile_count * sizeof(*world->tileset.profile_angles));
+				export_write_section(f, world->tileset.tile_profiles, tile_count * sizeof(*world->tileset.tile_profiles));
+
+				if (src_rects) {
+					export_write(f, &tile_count, sizeof(tile_count), 1);
+					export_write_section(f, src_rects, tile_count * sizeof(*src_rects));
+				}
+			} else {
+				export_write(f, &profiles_magic, sizeof(profiles_magic), 1);
+				export_write(f, &profile_count, sizeof(profile_count), 1);
+				export_write(f, &tile_count, sizeof(tile_count), 1);
+
+				export_write(f, world->tileset.profile_heights, 16 * sizeof(*world->tileset.profile_heights), profile_count);
+				export_write(f, world->tileset.profile_widths, 16 * sizeof(*world->tileset.profile_widths), profile_count);
+				export_write(f, world->tileset.profile_angles, sizeof(*world->tileset.profile_angles), profile_count);
+				export_write(f, world->tileset.tile_profiles, sizeof(*world->tileset.tile_profiles), tile_count);
+
+				if (src_rects) {
+					export_write(f, &tile_count, sizeof(tile_count), 1);
+					export_write(f, src_rects, sizeof(*src_rects), tile_count);
+				}
+			}
 
-			SDL_RWclose(f);
+			export_close(f, export_window.tileset_path);
 		} else {
 			char buf[256];
 			stb_snprintf(buf, sizeof(buf), "%s", SDL_GetError());
@@ -284,23 +403,105 @@ static void export_level() {
 		}
 	}
 
+	DestroyTileAtlas(&atlas);
+
 	{
 		if (SDL_RWops* f = SDL_RWFromFile(export_window.tilemap_path, "wb")) {
+			int layer_count = world->tilemap.layer_count;
+			{
+				int magic = TILEMAP_LAYERS_MAGIC;
+				export_write(f, &magic, sizeof(magic), 1);
+				export_write(f, &layer_count, sizeof(layer_count), 1);
+				export_write(f, world->tilemap.layer_flags, sizeof(*world->tilemap.layer_flags), layer_count);
+			}
+
+			if (export_window.split_into_regions) {
+				int magic = TILEMAP_REGIONS_MAGIC;
+				export_write(f, &magic, sizeof(magic), 1);
+			} else if (export_window.compress) {
+				int magic = LZ4_LEVEL_MAGIC;
+				export_write(f, &magic, sizeof(magic), 1);
+			}
+
 			int width  = world->tilemap.width;
 			int height = world->tilemap.height;
-			SDL_RWwrite(f, &width,  sizeof(width),  1);
-			SDL_RWwrite(f, &height, sizeof(height), 1);
+			export_write(f, &width,  sizeof(width),  1);
+			export_write(f, &height, sizeof(height), 1);
 
 			float start_x = world->tilemap.start_x;
 			float start_y = world->tilemap.start_y;
-			SDL_RWwrite(f, &start_x, sizeof(start_x), 1);
-			SDL_RWwrite(f, &start_y, sizeof(start_y), 1);
+			export_write(f, &start_x, sizeof(start_x), 1);
+			export_write(f, &start_y, sizeof(start_y), 1);
 
 			int tile_count = world->tilemap.tile_count;
-			SDL_RWwrite(f, world->tilemap.tiles_a, sizeof(*world->tilemap.tiles_a), tile_count);
-			SDL_RWwrite(f, world->tilemap.tiles_b, sizeof(*world->tilemap.tiles_b), tile_count);
+			if (export_window.split_into_regions) {
+				int region_size = TILEMAP_REGION_SIZE;
+				export_write(f, &region_size, sizeof(region_size), 1);
+
+				int regions_x = (width  + region_size - 1) / region_size;
+				int regions_y = (height + region_size - 1) / region_size;
+
+				// offsets are filled in once the regions are written
+				std::vector<uint32_t> offsets(regions_x * regions_y);
+				Sint64 offsets_pos = SDL_RWtell(f);
+				export_write(f, offsets.data(), sizeof(offsets[0]), offsets.size());
+
+				int region_tile_count = region_size * region_size;
+				std::vector<Tile> region(layer_count * region_tile_count);
+
+				for (int region_y = 0; region_y < regions_y; region_y++) {
+					for (int region_x = 0; region_x < regions_x; region_x++) {
+						bool empty = true;
+
+						for (int layer = 0; layer < layer_count; layer++) {
+							for (int y = 0; y < region_size; y++) {
+								for (int x = 0; x < region_size; x++) {
+									int tile_x = region_x * region_size + x;
+									int tile_y = region_y * region_size + y;
+									Tile tile = world->tilemap.GetTile(tile_x, tile_y, layer);
+									region[layer * region_tile_count + x + y * region_size] = tile;
+
+									if (tile.index != 0 || tile.top_solid || tile.left_right_bottom_solid) {
+										empty = false;
+									}
+								}
+							}
+						}
+
+						if (empty) {
+							continue;
+						}
 
-			SDL_RWclose(f);
+						offsets[region_x + region_y * regions_x] = (uint32_t) SDL_RWtell(f);
+						for (int layer = 0; layer < layer_count; layer++) {
+							export_write_section(f, &region[layer * region_tile_count], region_tile_count * sizeof(Tile));
+						}
+					}
+				}
+
+				if (SDL_RWseek(f, offsets_pos, RW_SEEK_SET) != offsets_pos) {
+					export_failed = true;
+				}
+				export_write(f, offsets.data(), sizeof(offsets[0]), offsets.size());
+			} else {
+				// the file stores each layer as a plain array of Tile, without the border
+				std::vector<Tile> tiles(tile_count);
+				for (int layer = 0; layer < layer_count; layer++) {
+					for (int y = 0; y < height; y++) {
+						for (int x = 0; x < width; x++) {
+							tiles[x + y * width] = world->tilemap.GetTile(x, y, layer);
+						}
+					}
+
+					if (export_window.compress) {
+						export_write_section(f, tiles.data(), tile_count * sizeof(Tile));
+					} else {
+						export_write(f, tiles.data(), sizeof(Tile), tile_count);
+					}
+				}
+			}
+
+			export_close(f, export_window.tilemap_path);
 		} else {
 			char buf[256];
 			stb_snprintf(buf, sizeof(buf), "%s", SDL_GetError());
@@ -311,15 +512,28 @@ static void export_level() {
 	{
 		if (SDL_RWops* f = SDL_RWFromFile(export_window.objects_path, "wb")) {
 			int object_count = world->object_count;
-			SDL_RWwrite(f, &object_count, sizeof(object_count), 1);
 
-			for (int i = 0; i < world->object_count; i++) {
-				Object o = world->objects[i];
-				o.id = -1;
-				SDL_RWwrite(f, &o, sizeof(o), 1);
+			if (export_window.compress) {
+				int magic = LZ4_LEVEL_MAGIC;
+				export_write(f, &magic, sizeof(magic), 1);
+				export_write(f, &object_count, sizeof(object_count), 1);
+
+				std::vector<Object> objects(world->objects, world->objects + object_count);
+				for (Object& o : objects) {
+					o.id = -1;
+				}
+				export_write_section(f, objects.data(), objects.size() * sizeof(Object));
+			} else {
+				export_write(f, &object_count, sizeof(object_count), 1);
+
+				for (int i = 0; i < world->object_count; i++) {
+					Object o = world->objects[i];
+					o.id = -1;
+					export_write(f, &o, sizeof(o), 1);
+				}
 			}
 
-			SDL_RWclose(f);
+			export_close(f, export_window.objects_path);
 		} else {
 			char buf[256];
 			stb_snprintf(buf, sizeof(buf), "%s", SDL_GetError());
@@ -328,14 +542,53 @@ static void export_level() {
 	}
 }
 
+static void dedup_tileset() {
+	if (world->tilemap.regions) {
+		SDL_ShowSimpleMessageBox(0, "ERROR", "Can't remap a tilemap that is split into regions. Import it unsplit first.", nullptr);
+		return;
+	}
+
+	SDL_Surface* surf = IMG_Load(tileset_texture_source);
+	if (!surf) {
+		SDL_ShowSimpleMessageBox(0, "ERROR", "Couldn't load the tileset texture.", nullptr);
+		return;
+	}
+
+	int tile_count = world->tileset.tile_count;
+	TileRemap* remap = (TileRemap*) ecalloc(max(tile_count, 1), sizeof(*remap));
+
+	int removed = DedupTileSet(&world->tileset, surf, remap);
+	if (removed >= 0) {
+		RemapTileMap(&world->tilemap, remap, tile_count);
+		world->InvalidateTileGraphics();
+		BuildTileUsers(&world->tile_users, &world->tilemap, &world->tileset);
+		if (selected_tile < tile_count) {
+			selected_tile = remap[selected_tile].index;
+		}
+		SDL_Log("Tileset dedup: %d tiles, %d removed.", tile_count, removed);
+	} else {
+		SDL_ShowSimpleMessageBox(0, "ERROR", "Couldn't read the tileset texture.", nullptr);
+	}
+
+	free(remap);
+	SDL_FreeSurface(surf);
+}
+
 static void import_level() {
 	world->tileset.Destroy();
 	world->tilemap.Destroy();
+	world->InvalidateTileGraphics();
 
-	world->tileset.LoadFromFile(import_window.tileset_path,
-								import_window.tileset_texture_path);
+	if (!world->tileset.LoadFromFile(import_window.tileset_path,
+									 import_window.tileset_texture_path)) {
+		world->tileset.Destroy();
+		return;
+	}
+	stb_snprintf(tileset_texture_source, sizeof(tileset_texture_source), "%s", import_window.tileset_texture_path);
 	world->tilemap.LoadFromFile(import_window.tilemap_path);
 	world->load_objects(import_window.objects_path);
+	world->tileset.ReleaseStaticGraphics();
+	BuildTileUsers(&world->tile_users, &world->tilemap, &world->tileset);
 
 	world->player.x = world->tilemap.start_x;
 	world->player.y = world->tilemap.start_y;
@@ -458,11 +711,17 @@ static void show_tilemap_window() {
 			// draw tiles
 			if (mode == MODE_TILEMAP) {
 				Uint32 mouse = SDL_GetMouseState(nullptr, nullptr);
-				if (mouse & SDL_BUTTON(SDL_BUTTON_LEFT)) {
-					world->tilemap.tiles_a[hover_tile_x + hover_tile_y * world->tilemap.width] = {};
-					world->tilemap.tiles_a[hover_tile_x + hover_tile_y * world->tilemap.width].index = selected_tile;
-					world->tilemap.tiles_a[hover_tile_x + hover_tile_y * world->tilemap.width].top_solid = true;
-					world->tilemap.tiles_a[hover_tile_x + hover_tile_y * world->tilemap.width].left_right_bottom_solid = true;
+				if ((mouse & SDL_BUTTON(SDL_BUTTON_LEFT)) && selected_layer < world->tilemap.layer_count) {
+					Tile tile = {};
+					tile.index = selected_tile;
+					tile.top_solid = true;
+					tile.left_right_bottom_solid = true;
+					Tile old = world->tilemap.GetTile(hover_tile_x, hover_tile_y, selected_layer);
+					world->tilemap.SetTile(hover_tile_x, hover_tile_y, selected_layer, tile);
+					world->InvalidateTile(hover_tile_x, hover_tile_y, selected_layer);
+					if (world->tileset.IsTileLive(old.index) || world->tileset.IsTileLive(tile.index)) {
+						BuildTileUsers(&world->tile_users, &world->tilemap, &world->tileset);
+					}
 				}
 			}
 		}
@@ -481,12 +740,13 @@ static void show_tilemap_window() {
 				// if (mode == MODE_TILEMAP) {
 					ImGui::Text("Tile X: %d", hover_tile_x);
 					ImGui::Text("Tile Y: %d", hover_tile_y);
-					Tile tile = world->tilemap.GetTileA(hover_tile_x, hover_tile_y);
+					Tile tile = world->tilemap.GetTile(hover_tile_x, hover_tile_y, selected_layer);
 					ImGui::Text("Tile ID: %d", tile.index);
 					ImGui::Text("Tile HFlip: %d", tile.hflip);
 					ImGui::Text("Tile VFlip: %d", tile.vflip);
 					ImGui::Text("Tile Top Solid: %d", tile.top_solid);
 					ImGui::Text("Tile Left/Right/Bottom Solid: %d", tile.left_right_bottom_solid);
+					ImGui::Text("Tile Priority: %d", tile.priority);
 				// } else if (mode == MODE_OBJECTS) {
 				// 	ImGui::Text("Mouse X: %f", game->mouse_x);
 				// 	ImGui::Text("Mouse Y: %f", game->mouse_y);
@@ -550,6 +810,38 @@ static void show_tileset_window() {
 	ImGui::End();
 }
 
+static void show_layers_window() {
+	if (ImGui::Begin("Layers")) {
+		for (int i = 0; i < world->tilemap.layer_count; i++) {
+			ImGui::PushID(i);
+
+			char label[32];
+			stb_snprintf(label, sizeof(label), "Layer %d", i);
+			if (ImGui::RadioButton(label, selected_layer == i)) {
+				selected_layer = i;
+			}
+
+			int* flags = &world->tilemap.layer_flags[i];
+			ImGui::SameLine();
+			ImGui::CheckboxFlags("Collision", flags, TILE_LAYER_COLLISION);
+			ImGui::SameLine();
+			ImGui::CheckboxFlags("Background", flags, TILE_LAYER_BACKGROUND);
+			ImGui::SameLine();
+			ImGui::CheckboxFlags("Foreground", flags, TILE_LAYER_FOREGROUND);
+
+			ImGui::PopID();
+		}
+
+		if (ImGui::Button("Add Layer")) {
+			int layer = world->tilemap.AddLayer(TILE_LAYER_BACKGROUND);
+			if (layer != -1) {
+				selected_layer = layer;
+			}
+		}
+	}
+	ImGui::End();
+}
+
 static void show_objects_window() {
 	if (ImGui::Begin("Objects")) {
 		if (ImGui::Button(ICON_FA_PLUS)) {
@@ -607,7 +899,106 @@ static void show_objects_window() {
 	ImGui::End();
 }
 
+// Rasterizes glyphs 32..126 with SDL_ttf into a 256x256 atlas and saves it
+// with the metrics, for LoadBakedFont. The game doesn't need SDL_ttf then.
+static bool bake_font(const char* ttf_fname, int ptsize, const char* fname, const char* atlas_fname) {
+	bool result = false;
+
+	Font font = {};
+	TTF_Font* ttf_font = nullptr;
+	SDL_Surface* atlas_surf = nullptr;
+
+	TTF_Init();
+
+	{
+		ttf_font = TTF_OpenFont(ttf_fname, ptsize);
+
+		if (!ttf_font) {
+			SDL_Log("Couldn't open font %s.", ttf_fname);
+			goto out;
+		}
+
+		font.ptsize = ptsize;
+		font.glyphs = (GlyphData*) ecalloc(FONT_GLYPH_COUNT, sizeof(*font.glyphs));
+
+		atlas_surf = SDL_CreateRGBSurfaceWithFormat(0, 256, 256, 32, SDL_PIXELFORMAT_ARGB8888);
+
+		if (!atlas_surf) {
+			goto out;
+		}
+
+		font.height = TTF_FontHeight(ttf_font);
+		font.ascent = TTF_FontAscent(ttf_font);
+		font.descent = TTF_FontDescent(ttf_font);
+		font.lineskip = TTF_FontLineSkip(ttf_font);
+
+		{
+			int minx;
+			int maxx;
+			int miny;
+			int maxy;
+			int advance;
+			TTF_GlyphMetrics(ttf_font, ' ', &minx, &maxx, &miny, &maxy, &advance);
+
+			font.glyphs[0].advance = advance;
+		}
+
+		int x = 0;
+		int y = 0;
+
+		for (unsigned char ch = 33; ch <= 126; ch++) {
+			SDL_Surface* glyph_surf = TTF_RenderGlyph_Blended(ttf_font, ch, {255, 255, 255, 255});
+
+			int minx;
+			int maxx;
+			int miny;
+			int maxy;
+			int advance;
+			TTF_GlyphMetrics(ttf_font, ch, &minx, &maxx, &miny, &maxy, &advance);
+
+			if (x + maxx - minx > atlas_surf->w) {
+				y += font.lineskip;
+				x = 0;
+			}
+
+			SDL_Rect src{minx, font.ascent - maxy, maxx - minx, maxy - miny};
+			SDL_Rect dest{x, y, maxx - minx, maxy - miny};
+			SDL_BlitSurface(glyph_surf, &src, atlas_surf, &dest);
+
+			font.glyphs[ch - 32].src = {x, y, maxx - minx, maxy - miny};
+			font.glyphs[ch - 32].xoffset = minx;
+			font.glyphs[ch - 32].yoffset = font.ascent - maxy;
+			font.glyphs[ch - 32].advance = advance;
+
+			x += maxx - minx;
+
+			SDL_FreeSurface(glyph_surf);
+		}
+
+		if (!SaveBakedFont(&font, atlas_surf, fname, atlas_fname)) {
+			SDL_Log("Couldn't save font %s.", fname);
+			goto out;
+		}
+
+		result = true;
+	}
+
+out:
+	if (font.glyphs) free(font.glyphs);
+	if (atlas_surf) SDL_FreeSurface(atlas_surf);
+	if (ttf_font) TTF_CloseFont(ttf_font);
+
+	TTF_Quit();
+
+	return result;
+}
+
 int editor_main(int argc, char* argv[]) {
+	// --bake-font <ttf> <ptsize> <file> <atlas png>, paths are relative to the editor folder
+	if (argc >= 6 && SDL_strcmp(argv[1], "--bake-font") == 0) {
+		return bake_font(argv[2], SDL_atoi(argv[3]), argv[4], argv[5]) ? 0 : 1;
+	}
+
 	_chdir("../CppSonic/");
 
 	Game game_instance{};
@@ -683,6 +1074,10 @@ int editor_main(int argc, char* argv[]) {
 						mouse_button_pressed = ev.button.button;
 						break;
 
+					case SDL_RENDER_TARGETS_RESET:
+						world->InvalidateTileGraphics();
+						break;
+
 					case SDL_KEYDOWN: {
 						SDL_Scancode scancode = ev.key.keysym.scancode;
 						if (0 <= scancode && scancode < ArrayLength(game->key_pressed)) {
@@ -750,6 +1145,10 @@ int editor_main(int argc, char* argv[]) {
 						export_window.show = true;
 					}
 
+					if (ImGui::MenuItem("Deduplicate Tileset")) {
+						dedup_tileset();
+					}
+
 					ImGui::EndMenu();
 				}
 
@@ -831,6 +1230,10 @@ int editor_main(int argc, char* argv[]) {
 					ImGui::InputText("tileset path", export_window.tileset_path, sizeof(export_window.tileset_path));
 					ImGui::InputText("tilemap path", export_window.tilemap_path, sizeof(export_window.tilemap_path));
 					ImGui::InputText("objects path", export_window.objects_path, sizeof(export_window.objects_path));
+					ImGui::InputText("tileset texture path", export_window.tileset_texture_path, sizeof(export_window.tileset_texture_path));
+					ImGui::Checkbox("build tileset atlas", &export_window.build_atlas);
+					ImGui::Checkbox("compress (LZ4)", &export_window.compress);
+					ImGui::Checkbox("split tilemap into regions (streaming)", &export_window.split_into_regions);
 
 					if (ButtonCentered("Export")) {
 						export_level();
@@ -868,6 +1271,8 @@ int editor_main(int argc, char* argv[]) {
 
 					show_tileset_window();
 
+					show_layers_window();
+
 					// if (ImGui::Begin("Info")) {
 					// 	ImGui::Text("Hold \"3\" to show tile heights");
 					// 	ImGui::Text("Hold \"4\" to show tile widths");